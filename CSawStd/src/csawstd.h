@@ -1,9 +1,316 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <csetjmp>
 #include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <random>
 #include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <pthread.h>
+#endif
+
+// thread-local bump allocator behind 'new': regions mark where they begin and give back
+// everything allocated since in one step; memory allocated outside any region lives until exit
+struct csaw_heap_t
+{
+	static constexpr size_t BLOCK = 64 * 1024;
+
+	struct block_t
+	{
+		size_t size;
+		alignas(16) char data[1];
+	};
+
+	struct mark_t
+	{
+		size_t blocks;
+		char* pos;
+	};
+
+	~csaw_heap_t()
+	{
+		for (auto block : blocks)
+			free(block);
+		for (auto block : spare)
+			free(block);
+	}
+
+	void Grow(size_t size)
+	{
+		block_t* block;
+		if (size <= BLOCK && !spare.empty())
+		{
+			block = spare.back();
+			spare.pop_back();
+		}
+		else
+		{
+			auto capacity = size > BLOCK ? size : BLOCK;
+			block = static_cast<block_t*>(malloc(offsetof(block_t, data) + capacity));
+			block->size = capacity;
+		}
+
+		blocks.push_back(block);
+		pos = block->data;
+		end = block->data + block->size;
+	}
+
+	void Release(size_t count, char* mark)
+	{
+		while (blocks.size() > count)
+		{
+			auto block = blocks.back();
+			blocks.pop_back();
+			if (block->size == BLOCK) // oversized blocks go back to the system
+				spare.push_back(block);
+			else
+				free(block);
+		}
+
+		pos = mark;
+		end = blocks.empty() ? nullptr : blocks.back()->data + blocks.back()->size;
+	}
+
+	std::vector<block_t*> blocks; // in use, the last one is being filled
+	std::vector<block_t*> spare; // given back by regions, reused before asking the system
+	std::vector<mark_t> marks; // one per open region
+	char* pos = nullptr;
+	char* end = nullptr;
+};
+
+static thread_local csaw_heap_t csaw_heap;
+
+extern "C" void* csaw_alloc(uint64_t size)
+{
+	size = (size + 15) & ~uint64_t(15);
+	if (size > uint64_t(csaw_heap.end - csaw_heap.pos))
+		csaw_heap.Grow(size);
+
+	auto ptr = csaw_heap.pos;
+	csaw_heap.pos += size;
+	return ptr;
+}
+
+extern "C" uint64_t csaw_region_begin()
+{
+	csaw_heap.marks.push_back({ csaw_heap.blocks.size(), csaw_heap.pos });
+	return csaw_heap.marks.size() - 1;
+}
+
+extern "C" void csaw_region_end(uint64_t region)
+{ // also closes every region opened inside it, so a return can leave several at once
+	if (region >= csaw_heap.marks.size())
+		return;
+
+	auto mark = csaw_heap.marks[region];
+	csaw_heap.marks.resize(region);
+	csaw_heap.Release(mark.blocks, mark.pos);
+}
+
+// managed heap behind 'new' with -gc: a non-moving mark-sweep collector that scans the stack, the
+// registers and the globals the compiler registers, conservatively, for words pointing into an object.
+// it only sees the stack of the thread that collects, so a program using it has to be single threaded
+struct csaw_gc_t
+{
+	struct object_t
+	{
+		size_t size;
+		bool marked;
+		bool scan; // false for strings, which hold no pointers
+		alignas(16) char data[1];
+	};
+
+	object_t* Find(uintptr_t word) const
+	{ // the object containing the address, also for pointers into the middle of one
+		auto next = std::upper_bound(objects.begin(), objects.end(), word, [](uintptr_t w, const object_t* o) { return w < uintptr_t(o->data); });
+		if (next == objects.begin())
+			return nullptr;
+
+		auto object = *(next - 1);
+		return word < uintptr_t(object->data) + (object->size ? object->size : 1) ? object : nullptr;
+	}
+
+	void Scan(const void* begin, const void* end)
+	{
+		auto from = reinterpret_cast<const uintptr_t*>((uintptr_t(begin) + sizeof(uintptr_t) - 1) & ~(sizeof(uintptr_t) - 1));
+		auto to = reinterpret_cast<const uintptr_t*>(end);
+		for (auto word = from; word < to; word++)
+			if (auto object = Find(*word); object && !object->marked)
+			{
+				object->marked = true;
+				if (object->scan)
+					pending.push_back(object);
+			}
+	}
+
+	static char* StackBase()
+	{
+#ifdef _WIN32
+		return reinterpret_cast<char*>(__readgsqword(0x08)); // NT_TIB::StackBase of the current thread, x64
+#else
+		pthread_attr_t attr;
+		void* addr;
+		size_t size;
+		pthread_getattr_np(pthread_self(), &attr);
+		pthread_attr_getstack(&attr, &addr, &size);
+		pthread_attr_destroy(&attr);
+		return static_cast<char*>(addr) + size;
+#endif
+	}
+
+	void Collect()
+	{
+		auto begin = std::chrono::steady_clock::now();
+
+		std::sort(objects.begin(), objects.end());
+
+		std::jmp_buf registers; // callee saved registers may hold the only pointer to an object
+		setjmp(registers);
+		Scan(&registers, StackBase()); // from here up through every caller
+		for (auto& [root, size] : roots)
+			Scan(root, static_cast<char*>(root) + size);
+
+		while (!pending.empty())
+		{
+			auto object = pending.back();
+			pending.pop_back();
+			Scan(object->data, object->data + object->size);
+		}
+
+		live = 0;
+		size_t kept = 0;
+		for (auto object : objects)
+		{
+			if (!object->marked)
+			{
+				freed += object->size;
+				free(object);
+				continue;
+			}
+
+			object->marked = false;
+			live += object->size;
+			objects[kept++] = object;
+		}
+		objects.resize(kept);
+
+		since = 0;
+		threshold = std::max<size_t>(live * 2, 1 << 20);
+
+		auto pause = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+		collections++;
+		pauseTotal += pause;
+		pauseMax = std::max(pauseMax, pause);
+	}
+
+	void* Allocate(size_t size, bool scan)
+	{
+		if (since >= threshold)
+			Collect();
+
+		auto object = static_cast<object_t*>(malloc(offsetof(object_t, data) + (size ? size : 1)));
+		object->size = size;
+		object->marked = false;
+		object->scan = scan;
+		objects.push_back(object); // past the sorted range, Collect sorts again before it looks anything up
+
+		since += size;
+		allocations++;
+		allocated += size;
+		return object->data;
+	}
+
+	std::vector<object_t*> objects;
+	std::vector<object_t*> pending; // marked, their fields not scanned yet
+	std::vector<std::pair<void*, size_t>> roots;
+	size_t threshold = 1 << 20; // bytes allocated before the next collection
+	size_t since = 0;
+	size_t live = 0;
+	bool enabled = false;
+
+	uint64_t allocations = 0, allocated = 0, freed = 0, collections = 0;
+	double pauseTotal = 0, pauseMax = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+};
+
+static csaw_gc_t csaw_gc;
+
+extern "C" void csaw_gc_enable()
+{
+	csaw_gc.enabled = true;
+}
+
+extern "C" void* csaw_gc_alloc(uint64_t size)
+{
+	auto ptr = csaw_gc.Allocate(size, true);
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+extern "C" void csaw_gc_root(void* ptr, uint64_t size)
+{
+	csaw_gc.roots.push_back({ ptr, size });
+}
+
+extern "C" void csaw_gc_collect()
+{
+	csaw_gc.Collect();
+}
+
+extern "C" void csaw_gc_stats()
+{
+	auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - csaw_gc.start).count();
+	printf("GC: %llu objects, %llu bytes allocated (%.1f MB/s), %llu bytes freed, %zu bytes live\n",
+		(unsigned long long)csaw_gc.allocations, (unsigned long long)csaw_gc.allocated, csaw_gc.allocated / seconds / (1 << 20),
+		(unsigned long long)csaw_gc.freed, csaw_gc.live);
+	printf("GC: %llu collections, %.3f ms paused in total, %.3f ms at most\n",
+		(unsigned long long)csaw_gc.collections, csaw_gc.pauseTotal, csaw_gc.pauseMax);
+}
+
+// a str is a NUL terminated char pointer, so it passes straight to C, with its length stored in the
+// 8 bytes in front of the chars; literals from the compiler have the same layout. a char pointer
+// from C has no such header, csaw declares it as a cstr and copies it with csaw_str_from_c
+struct csaw_str_t
+{
+	uint64_t length;
+	char chars[1];
+};
+
+static const csaw_str_t* csaw_str_header(const char* x)
+{
+	return reinterpret_cast<const csaw_str_t*>(x - offsetof(csaw_str_t, chars));
+}
+
+static uint64_t csaw_str_length(const char* x)
+{
+	return x ? csaw_str_header(x)->length : 0;
+}
+
+static char* csaw_str_new(size_t length)
+{ // collected with -gc, released with the region around it otherwise
+	auto size = offsetof(csaw_str_t, chars) + length + 1;
+	auto str = static_cast<csaw_str_t*>(csaw_gc.enabled ? csaw_gc.Allocate(size, false) : csaw_alloc(size));
+	str->length = length;
+	str->chars[length] = 0;
+	return str->chars;
+}
+
+static char* csaw_str_new(const char* chars, size_t length)
+{
+	auto str = csaw_str_new(length);
+	memcpy(str, chars, length);
+	return str;
+}
 
 extern "C" void csaw_vprintf(const char* format, std::va_list va)
 {
@@ -17,10 +324,7 @@ extern "C" char* csaw_vreadf(const char* format, std::va_list va)
 	std::string line;
 	std::getline(std::cin, line);
 
-	char* str = new char[line.size() + 1];
-	strcpy_s(str, line.length() + 1, line.c_str());
-
-	return str;
+	return csaw_str_new(line.data(), line.size());
 }
 
 extern "C" void csaw_printf(const char* format, ...)
@@ -41,10 +345,7 @@ extern "C" char* csaw_readf(const char* format, ...)
 	std::string line;
 	std::getline(std::cin, line);
 
-	char* str = new char[line.size() + 1];
-	strcpy_s(str, line.length() + 1, line.c_str());
-
-	return str;
+	return csaw_str_new(line.data(), line.size());
 }
 
 extern "C" double csaw_random()
@@ -58,36 +359,79 @@ extern "C" double csaw_str_to_num(const char* x)
 }
 
 extern "C" double csaw_chr_to_num(char x)
-{
-	return double(x);
+{ // chr is unsigned in csaw
+	return double((unsigned char)x);
 }
 
 extern "C" const char* csaw_num_to_str(double x)
 {
 	auto s = std::to_string(x);
-	char* str = new char[s.length()];
-	strcpy_s(str, s.length(), s.c_str());
-	return str;
+	return csaw_str_new(s.data(), s.size());
+}
+
+extern "C" const char* csaw_str_from_c(const char* x)
+{
+	if (!x)
+		return nullptr;
+	return csaw_str_new(x, strlen(x));
 }
 
 extern "C" char csaw_num_to_chr(double x)
 {
-	return char(x);
+	return char((unsigned char)x);
 }
 
 extern "C" double csaw_str_cmp(const char* a, const char* b)
-{
+{ // < 0, 0 or > 0 like strcmp, a null string sorts first
 	if (a == b)
-		return 1;
-	if (!a || !b)
 		return 0;
+	if (!a || !b)
+		return a ? 1 : -1;
 
-	return strcmp(a, b);
+	auto la = csaw_str_length(a);
+	auto lb = csaw_str_length(b);
+	if (auto result = memcmp(a, b, std::min(la, lb)))
+		return result;
+	return la < lb ? -1 : la > lb ? 1 : 0;
+}
+
+extern "C" double csaw_str_eq(const char* a, const char* b)
+{ // strings of different length differ without looking at a single char
+	if (a == b)
+		return 1;
+	if (!a || !b || csaw_str_length(a) != csaw_str_length(b))
+		return 0;
+	return !memcmp(a, b, csaw_str_length(a));
 }
 
 extern "C" double csaw_str_len(const char* x)
 {
-	return double(strlen(x));
+	return double(csaw_str_length(x));
+}
+
+extern "C" const char* csaw_str_cat(const char* a, const char* b)
+{
+	auto la = csaw_str_length(a);
+	auto lb = csaw_str_length(b);
+	if (!lb && a)
+		return a;
+	if (!la && b)
+		return b;
+
+	auto str = csaw_str_new(la + lb);
+	memcpy(str, a, la);
+	memcpy(str + la, b, lb);
+	return str;
+}
+
+extern "C" const char* csaw_str_sub(const char* x, double begin, double end)
+{ // chars [begin, end), clamped to the string
+	auto length = csaw_str_length(x);
+	auto from = uint64_t(std::clamp(begin, 0.0, double(length)));
+	auto to = uint64_t(std::clamp(end, double(from), double(length)));
+	if (from == 0 && to == length)
+		return x;
+	return csaw_str_new(x + from, to - from);
 }
 
 extern "C" char csaw_str_get(const char* x, double i)
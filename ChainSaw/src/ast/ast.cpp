@@ -2,6 +2,36 @@
 
 #include <iostream>
 
+csaw::ASTArena::~ASTArena()
+{
+	for (auto it = m_Destructors.rbegin(); it != m_Destructors.rend(); it++)
+		it->second(it->first);
+}
+
+void* csaw::ASTArena::Allocate(size_t size, size_t align)
+{
+	auto ptr = (char*)(((uintptr_t)m_Ptr + align - 1) & ~(uintptr_t)(align - 1));
+	if (m_Ptr && ptr + size <= m_End)
+	{
+		m_Ptr = ptr + size;
+		return ptr;
+	}
+
+	if (size + align > BLOCK_SIZE) // oversized nodes get a block of their own
+	{
+		auto& block = m_Blocks.emplace_back(new char[size + align]);
+		return (void*)(((uintptr_t)block.get() + align - 1) & ~(uintptr_t)(align - 1));
+	}
+
+	auto& block = m_Blocks.emplace_back(new char[BLOCK_SIZE]);
+	m_Ptr = (char*)(((uintptr_t)block.get() + align - 1) & ~(uintptr_t)(align - 1));
+	m_End = block.get() + BLOCK_SIZE;
+
+	ptr = m_Ptr;
+	m_Ptr += size;
+	return ptr;
+}
+
 std::ostream& csaw::operator<<(std::ostream& out, const ASTParameter& parameter)
 {
 	return out << parameter.Name << ": " << parameter.Type;
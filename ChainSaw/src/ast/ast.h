@@ -3,10 +3,40 @@
 #include <memory>
 #include <ostream>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 namespace csaw
 {
+	class ASTArena
+	{
+	public:
+		ASTArena() {}
+		ASTArena(const ASTArena&) = delete;
+		ASTArena& operator=(const ASTArena&) = delete;
+		~ASTArena();
+
+		template<typename T, typename... Args>
+		T* New(Args&&... args)
+		{
+			auto node = new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+			if constexpr (!std::is_trivially_destructible_v<T>)
+				m_Destructors.push_back({ node, [](void* ptr) { static_cast<T*>(ptr)->~T(); } });
+			return node;
+		}
+
+	private:
+		void* Allocate(size_t size, size_t align);
+
+	private:
+		static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+		std::vector<std::unique_ptr<char[]>> m_Blocks;
+		char* m_Ptr = nullptr;
+		char* m_End = nullptr;
+		std::vector<std::pair<void*, void(*)(void*)>> m_Destructors;
+	};
+
 	struct ASTArrayType;
 
 	struct ASTType
@@ -50,24 +80,75 @@ namespace csaw
 		const std::shared_ptr<ASTType> Type;
 	};
 
+	enum NodeKind
+	{
+		STMT_ALIAS,
+		STMT_ENCLOSED,
+		STMT_FOR,
+		STMT_FUN,
+		STMT_IF,
+		STMT_INC,
+		STMT_REGION,
+		STMT_RET,
+		STMT_THING,
+		STMT_VAR,
+		STMT_WHILE,
+		EXPR_BIN,
+		EXPR_CALL,
+		EXPR_CHR,
+		EXPR_CON,
+		EXPR_ID,
+		EXPR_INDEX,
+		EXPR_LAMBDA,
+		EXPR_MEM,
+		EXPR_NEW,
+		EXPR_NUM,
+		EXPR_STR,
+		EXPR_UN,
+		EXPR_VARARG,
+	};
+
 	struct Stmt
 	{
+		Stmt(const NodeKind kind)
+			: Kind(kind) {}
 		virtual ~Stmt() {}
 
 		virtual std::ostream& operator>>(std::ostream& out) const = 0;
+
+		bool IsExpr() const { return Kind >= EXPR_BIN; }
+
+		const NodeKind Kind;
 	};
 
 	struct Expr : Stmt
 	{
+		Expr(const NodeKind kind)
+			: Stmt(kind) {}
 		virtual ~Expr() {}
 
 		virtual std::ostream& operator>>(std::ostream& out) const = 0;
 	};
 
+	// checked downcast by kind tag, returns nullptr on mismatch
+	template<typename T>
+	const T* As(const Stmt* node)
+	{
+		return node && node->Kind == T::KIND ? static_cast<const T*>(node) : nullptr;
+	}
+
+	template<typename T>
+	T* As(Stmt* node)
+	{
+		return node && node->Kind == T::KIND ? static_cast<T*>(node) : nullptr;
+	}
+
 	struct AliasStmt : Stmt
 	{
+		static constexpr NodeKind KIND = STMT_ALIAS;
+
 		AliasStmt(const std::string& alias, const std::shared_ptr<ASTType>& origin)
-			: Alias(alias), Origin(origin) {}
+			: Stmt(KIND), Alias(alias), Origin(origin) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
@@ -77,31 +158,37 @@ namespace csaw
 
 	struct EnclosedStmt : Stmt
 	{
-		EnclosedStmt(const std::vector<std::shared_ptr<Stmt>>& body)
-			: Body(body) {}
+		static constexpr NodeKind KIND = STMT_ENCLOSED;
+
+		EnclosedStmt(const std::vector<Stmt*>& body)
+			: Stmt(KIND), Body(body) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
-		const std::vector<std::shared_ptr<Stmt>> Body;
+		const std::vector<Stmt*> Body;
 	};
 
 	struct ForStmt : Stmt
 	{
-		ForStmt(const std::shared_ptr<Stmt>& begin, const std::shared_ptr<Expr>& condition, const std::shared_ptr<Stmt>& loop, const std::shared_ptr<Stmt>& body)
-			: Begin(begin), Condition(condition), Loop(loop), Body(body) {}
+		static constexpr NodeKind KIND = STMT_FOR;
+
+		ForStmt(Stmt* begin, Expr* condition, Stmt* loop, Stmt* body)
+			: Stmt(KIND), Begin(begin), Condition(condition), Loop(loop), Body(body) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
-		const std::shared_ptr<Stmt> Begin;
-		const std::shared_ptr<Expr> Condition;
-		const std::shared_ptr<Stmt> Loop;
-		const std::shared_ptr<Stmt> Body;
+		Stmt* const Begin;
+		Expr* const Condition;
+		Stmt* const Loop;
+		Stmt* const Body;
 	};
 
 	struct FunStmt : Stmt
 	{
-		FunStmt(const bool is_constructor, const std::string& name, const std::shared_ptr<ASTType>& ret_type, const std::vector<ASTParameter>& parameters, const bool is_var_arg, const std::shared_ptr<ASTType>& member_of, const std::shared_ptr<EnclosedStmt>& body)
-			: IsConstructor(is_constructor), Name(name), RetType(ret_type), Parameters(parameters), IsVarArg(is_var_arg), MemberOf(member_of), Body(body) {}
+		static constexpr NodeKind KIND = STMT_FUN;
+
+		FunStmt(const bool is_constructor, const std::string& name, const std::shared_ptr<ASTType>& ret_type, const std::vector<ASTParameter>& parameters, const bool is_var_arg, const std::shared_ptr<ASTType>& member_of, const bool is_fast, EnclosedStmt* body)
+			: Stmt(KIND), IsConstructor(is_constructor), Name(name), RetType(ret_type), Parameters(parameters), IsVarArg(is_var_arg), MemberOf(member_of), IsFast(is_fast), Body(body) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
@@ -111,103 +198,135 @@ namespace csaw
 		const std::vector<ASTParameter> Parameters;
 		const bool IsVarArg;
 		const std::shared_ptr<ASTType> MemberOf;
-		const std::shared_ptr<EnclosedStmt> Body;
+		const bool IsFast;
+		EnclosedStmt* const Body;
 	};
 
 	struct IfStmt : Stmt
 	{
-		IfStmt(const std::shared_ptr<Expr>& condition, const std::shared_ptr<Stmt>& then, const std::shared_ptr<Stmt>& else_)
-			: Condition(condition), Then(then), Else(else_) {}
+		static constexpr NodeKind KIND = STMT_IF;
+
+		IfStmt(Expr* condition, Stmt* then, Stmt* else_)
+			: Stmt(KIND), Condition(condition), Then(then), Else(else_) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
-		const std::shared_ptr<Expr> Condition;
-		const std::shared_ptr<Stmt> Then;
-		const std::shared_ptr<Stmt> Else;
+		Expr* const Condition;
+		Stmt* const Then;
+		Stmt* const Else;
 	};
 
 	struct IncStmt : Stmt
 	{
+		static constexpr NodeKind KIND = STMT_INC;
+
 		IncStmt(const std::string& path)
-			: Path(path) {}
+			: Stmt(KIND), Path(path) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
 		const std::string Path;
 	};
 
+	struct RegionStmt : Stmt
+	{
+		static constexpr NodeKind KIND = STMT_REGION;
+
+		RegionStmt(Stmt* body)
+			: Stmt(KIND), Body(body) {}
+
+		std::ostream& operator>>(std::ostream& out) const override;
+
+		Stmt* const Body;
+	};
+
 	struct RetStmt : Stmt
 	{
-		RetStmt(const std::shared_ptr<Expr >& value)
-			: Value(value) {}
+		static constexpr NodeKind KIND = STMT_RET;
+
+		RetStmt(Expr* value)
+			: Stmt(KIND), Value(value) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
-		const std::shared_ptr<Expr> Value;
+		Expr* const Value;
 	};
 
 	struct ThingStmt : Stmt
 	{
-		ThingStmt(const std::string& name, const std::string& group, const std::vector<ASTParameter>& fields)
-			: Name(name), Group(group), Fields(fields) {}
+		static constexpr NodeKind KIND = STMT_THING;
+
+		ThingStmt(const std::string& name, const std::string& group, const std::vector<ASTParameter>& fields, bool isValue)
+			: Stmt(KIND), Name(name), Group(group), Fields(fields), IsValue(isValue) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
 		const std::string Name;
 		const std::string Group;
 		const std::vector<ASTParameter> Fields;
+		const bool IsValue; // copied like a number instead of referenced, kept in registers where possible
 	};
 
 	struct VarStmt : Stmt
 	{
-		VarStmt(const std::shared_ptr<ASTType>& type, const std::string& name, const std::shared_ptr<Expr>& value)
-			: Type(type), Name(name), Value(value) {}
+		static constexpr NodeKind KIND = STMT_VAR;
+
+		VarStmt(const std::shared_ptr<ASTType>& type, const std::string& name, Expr* value)
+			: Stmt(KIND), Type(type), Name(name), Value(value) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
 		const std::shared_ptr<ASTType> Type;
 		const std::string Name;
-		const std::shared_ptr<Expr> Value;
+		Expr* const Value;
 	};
 
 	struct WhileStmt : Stmt
 	{
-		WhileStmt(const std::shared_ptr<Expr >& condition, const std::shared_ptr<Stmt>& body)
-			: Condition(condition), Body(body) {}
+		static constexpr NodeKind KIND = STMT_WHILE;
+
+		WhileStmt(Expr* condition, Stmt* body)
+			: Stmt(KIND), Condition(condition), Body(body) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
-		const std::shared_ptr<Expr> Condition;
-		const std::shared_ptr<Stmt> Body;
+		Expr* const Condition;
+		Stmt* const Body;
 	};
 
 	struct BinExpr : Expr
 	{
-		BinExpr(const std::shared_ptr<Expr>& left, const std::shared_ptr<Expr>& right, const std::string& operator_)
-			: Left(left), Operator(operator_), Right(right) {}
+		static constexpr NodeKind KIND = EXPR_BIN;
+
+		BinExpr(Expr* left, Expr* right, const std::string& operator_)
+			: Expr(KIND), Left(left), Operator(operator_), Right(right) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
-		const std::shared_ptr<Expr> Left;
+		Expr* const Left;
 		const std::string Operator;
-		const std::shared_ptr<Expr> Right;
+		Expr* const Right;
 	};
 
 	struct CallExpr : Expr
 	{
-		CallExpr(const std::shared_ptr<Expr>& function, const std::vector<std::shared_ptr<Expr>>& arguments)
-			: Function(function), Arguments(arguments) {}
+		static constexpr NodeKind KIND = EXPR_CALL;
+
+		CallExpr(Expr* function, const std::vector<Expr*>& arguments)
+			: Expr(KIND), Function(function), Arguments(arguments) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
-		const std::shared_ptr<Expr> Function;
-		const std::vector<std::shared_ptr<Expr>> Arguments;
+		Expr* const Function;
+		const std::vector<Expr*> Arguments;
 	};
 
 	struct ChrExpr : Expr
 	{
+		static constexpr NodeKind KIND = EXPR_CHR;
+
 		ChrExpr(const char value)
-			: Value(value) {}
+			: Expr(KIND), Value(value) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
@@ -216,20 +335,24 @@ namespace csaw
 
 	struct ConExpr : Expr
 	{
-		ConExpr(const std::shared_ptr<Expr>& condition, const std::shared_ptr<Expr>& then, const std::shared_ptr<Expr>& else_)
-			: Condition(condition), Then(then), Else(else_) {}
+		static constexpr NodeKind KIND = EXPR_CON;
+
+		ConExpr(Expr* condition, Expr* then, Expr* else_)
+			: Expr(KIND), Condition(condition), Then(then), Else(else_) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
-		const std::shared_ptr<Expr> Condition;
-		const std::shared_ptr<Expr> Then;
-		const std::shared_ptr<Expr> Else;
+		Expr* const Condition;
+		Expr* const Then;
+		Expr* const Else;
 	};
 
 	struct IdExpr : Expr
 	{
+		static constexpr NodeKind KIND = EXPR_ID;
+
 		IdExpr(const std::string& value)
-			: Value(value) {}
+			: Expr(KIND), Value(value) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
@@ -238,48 +361,69 @@ namespace csaw
 
 	struct IndexExpr : Expr
 	{
-		IndexExpr(const std::shared_ptr<Expr>& object, const std::shared_ptr<Expr>& index)
-			: Object(object), Index(index) {}
+		static constexpr NodeKind KIND = EXPR_INDEX;
+
+		IndexExpr(Expr* object, Expr* index)
+			: Expr(KIND), Object(object), Index(index) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
-		const std::shared_ptr<Expr> Object;
-		const std::shared_ptr<Expr> Index;
+		Expr* const Object;
+		Expr* const Index;
 	};
 
 	struct LambdaExpr : Expr
 	{
-		LambdaExpr(const std::vector<std::shared_ptr<IdExpr>>& passed, const std::vector<ASTParameter>& parameters, const std::shared_ptr<Stmt>& body)
-			: Passed(passed), Parameters(parameters), Body(body) {}
+		static constexpr NodeKind KIND = EXPR_LAMBDA;
+
+		LambdaExpr(const std::vector<IdExpr*>& passed, const std::vector<ASTParameter>& parameters, Stmt* body)
+			: Expr(KIND), Passed(passed), Parameters(parameters), Body(body) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
-		const std::vector<std::shared_ptr<IdExpr>> Passed;
+		const std::vector<IdExpr*> Passed;
 		const std::vector<ASTParameter> Parameters;
-		const std::shared_ptr<Stmt> Body;
+		Stmt* const Body;
 	};
 
 	struct MemExpr : Expr
 	{
-		MemExpr(const std::shared_ptr<Expr>& object, const std::string& member)
-			: Object(object), Member(member) {}
+		static constexpr NodeKind KIND = EXPR_MEM;
+
+		MemExpr(Expr* object, const std::string& member)
+			: Expr(KIND), Object(object), Member(member) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
-		const std::shared_ptr<Expr> Object;
+		Expr* const Object;
 		const std::string Member;
 	};
 
+	struct NewExpr : Expr
+	{
+		static constexpr NodeKind KIND = EXPR_NEW;
+
+		NewExpr(const std::string& type, const std::vector<Expr*>& arguments)
+			: Expr(KIND), Type(type), Arguments(arguments) {}
+
+		std::ostream& operator>>(std::ostream& out) const override;
+
+		const std::string Type;
+		const std::vector<Expr*> Arguments;
+	};
+
 	struct NumExpr : Expr
 	{
+		static constexpr NodeKind KIND = EXPR_NUM;
+
 		NumExpr(const double value)
-			: Value(value) {}
+			: Expr(KIND), Value(value) {}
 
 		NumExpr(const std::string& value)
-			: Value(std::stod(value)) {}
+			: Expr(KIND), Value(std::stod(value)) {}
 
 		NumExpr(const std::string& value, int radix)
-			: Value(std::stol(value, nullptr, radix)) {}
+			: Expr(KIND), Value(std::stol(value, nullptr, radix)) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
@@ -288,8 +432,10 @@ namespace csaw
 
 	struct StrExpr : Expr
 	{
+		static constexpr NodeKind KIND = EXPR_STR;
+
 		StrExpr(const std::string& value)
-			: Value(value) {}
+			: Expr(KIND), Value(value) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
@@ -298,21 +444,26 @@ namespace csaw
 
 	struct UnExpr : Expr
 	{
-		UnExpr(const std::string& operator_, const std::shared_ptr<Expr>& value)
-			: Operator(operator_), Value(value) {}
+		static constexpr NodeKind KIND = EXPR_UN;
+
+		UnExpr(const std::string& operator_, Expr* value)
+			: Expr(KIND), Operator(operator_), Value(value) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
 		const std::string Operator;
-		const std::shared_ptr<Expr> Value;
+		Expr* const Value;
 	};
 
 	struct VarArgExpr : Expr
 	{
-		VarArgExpr() {}
+		static constexpr NodeKind KIND = EXPR_VARARG;
+
+		VarArgExpr()
+			: Expr(KIND) {}
 
 		VarArgExpr(const std::shared_ptr<ASTType>& type)
-			: Type(type) {}
+			: Expr(KIND), Type(type) {}
 
 		std::ostream& operator>>(std::ostream& out) const override;
 
@@ -323,7 +474,7 @@ namespace csaw
 	std::ostream& operator<<(std::ostream& out, const std::shared_ptr<ASTType>& type);
 	std::ostream& operator<<(std::ostream& out, const std::shared_ptr<ASTArrayType>& type);
 
-	std::ostream& operator<<(std::ostream& out, const std::shared_ptr<Stmt>& stmt);
-	std::ostream& operator<<(std::ostream& out, const std::shared_ptr<Expr>& expr);
+	std::ostream& operator<<(std::ostream& out, const Stmt* stmt);
+	std::ostream& operator<<(std::ostream& out, const Expr* expr);
 
 }
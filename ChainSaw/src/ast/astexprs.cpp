@@ -1,29 +1,24 @@
 #include "ast.h"
 
-std::ostream& csaw::operator<<(std::ostream& out, const std::shared_ptr<Expr>& expr)
+std::ostream& csaw::operator<<(std::ostream& out, const Expr* expr)
 {
-	if (auto e = std::dynamic_pointer_cast<BinExpr>(expr))
-		return *e.get() >> out;
-	if (auto e = std::dynamic_pointer_cast<CallExpr>(expr))
-		return *e.get() >> out;
-	if (auto e = std::dynamic_pointer_cast<ConExpr>(expr))
-		return *e.get() >> out;
-	if (auto e = std::dynamic_pointer_cast<IdExpr>(expr))
-		return *e.get() >> out;
-	if (auto e = std::dynamic_pointer_cast<IndexExpr>(expr))
-		return *e.get() >> out;
-	if (auto e = std::dynamic_pointer_cast<LambdaExpr>(expr))
-		return *e.get() >> out;
-	if (auto e = std::dynamic_pointer_cast<MemExpr>(expr))
-		return *e.get() >> out;
-	if (auto e = std::dynamic_pointer_cast<NumExpr>(expr))
-		return *e.get() >> out;
-	if (auto e = std::dynamic_pointer_cast<StrExpr>(expr))
-		return *e.get() >> out;
-	if (auto e = std::dynamic_pointer_cast<UnExpr>(expr))
-		return *e.get() >> out;
-	if (auto e = std::dynamic_pointer_cast<VarArgExpr>(expr))
-		return *e.get() >> out;
+	switch (expr->Kind)
+	{
+	case EXPR_BIN: return *static_cast<const BinExpr*>(expr) >> out;
+	case EXPR_CALL: return *static_cast<const CallExpr*>(expr) >> out;
+	case EXPR_CHR: return *static_cast<const ChrExpr*>(expr) >> out;
+	case EXPR_CON: return *static_cast<const ConExpr*>(expr) >> out;
+	case EXPR_ID: return *static_cast<const IdExpr*>(expr) >> out;
+	case EXPR_INDEX: return *static_cast<const IndexExpr*>(expr) >> out;
+	case EXPR_LAMBDA: return *static_cast<const LambdaExpr*>(expr) >> out;
+	case EXPR_MEM: return *static_cast<const MemExpr*>(expr) >> out;
+	case EXPR_NEW: return *static_cast<const NewExpr*>(expr) >> out;
+	case EXPR_NUM: return *static_cast<const NumExpr*>(expr) >> out;
+	case EXPR_STR: return *static_cast<const StrExpr*>(expr) >> out;
+	case EXPR_UN: return *static_cast<const UnExpr*>(expr) >> out;
+	case EXPR_VARARG: return *static_cast<const VarArgExpr*>(expr) >> out;
+	default: break;
+	}
 
 	throw;
 }
@@ -79,7 +74,7 @@ std::ostream& csaw::LambdaExpr::operator>>(std::ostream& out) const
 	{
 		if (first) first = false;
 		else out << ", ";
-		*passed.get() >> out;
+		*passed >> out;
 	}
 	out << "](";
 	first = true;
@@ -97,6 +92,19 @@ std::ostream& csaw::MemExpr::operator>>(std::ostream& out) const
 	return out << Object << '.' << Member;
 }
 
+std::ostream& csaw::NewExpr::operator>>(std::ostream& out) const
+{
+	out << "new " << Type << "(";
+	bool first = true;
+	for (auto& arg : Arguments)
+	{
+		if (first) first = false;
+		else out << ", ";
+		out << arg;
+	}
+	return out << ")";
+}
+
 std::ostream& csaw::NumExpr::operator>>(std::ostream& out) const
 {
 	return out << Value;
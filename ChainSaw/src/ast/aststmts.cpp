@@ -2,34 +2,29 @@
 
 static size_t depth = 0;
 
-std::ostream& csaw::operator<<(std::ostream& out, const std::shared_ptr<Stmt>& stmt)
+std::ostream& csaw::operator<<(std::ostream& out, const Stmt* stmt)
 {
 	if (!stmt)
 		return out;
 
-	if (auto s = std::dynamic_pointer_cast<AliasStmt>(stmt))
-		return *s.get() >> out;
-	if (auto s = std::dynamic_pointer_cast<EnclosedStmt>(stmt))
-		return *s.get() >> out;
-	if (auto s = std::dynamic_pointer_cast<ForStmt>(stmt))
-		return *s.get() >> out;
-	if (auto s = std::dynamic_pointer_cast<FunStmt>(stmt))
-		return *s.get() >> out;
-	if (auto s = std::dynamic_pointer_cast<IfStmt>(stmt))
-		return *s.get() >> out;
-	if (auto s = std::dynamic_pointer_cast<IncStmt>(stmt))
-		return *s.get() >> out;
-	if (auto s = std::dynamic_pointer_cast<RetStmt>(stmt))
-		return *s.get() >> out;
-	if (auto s = std::dynamic_pointer_cast<ThingStmt>(stmt))
-		return *s.get() >> out;
-	if (auto s = std::dynamic_pointer_cast<VarStmt>(stmt))
-		return *s.get() >> out;
-	if (auto s = std::dynamic_pointer_cast<WhileStmt>(stmt))
-		return *s.get() >> out;
-
-	if (auto e = std::dynamic_pointer_cast<Expr>(stmt))
-		return out << e << ';';
+	switch (stmt->Kind)
+	{
+	case STMT_ALIAS: return *static_cast<const AliasStmt*>(stmt) >> out;
+	case STMT_ENCLOSED: return *static_cast<const EnclosedStmt*>(stmt) >> out;
+	case STMT_FOR: return *static_cast<const ForStmt*>(stmt) >> out;
+	case STMT_FUN: return *static_cast<const FunStmt*>(stmt) >> out;
+	case STMT_IF: return *static_cast<const IfStmt*>(stmt) >> out;
+	case STMT_INC: return *static_cast<const IncStmt*>(stmt) >> out;
+	case STMT_REGION: return *static_cast<const RegionStmt*>(stmt) >> out;
+	case STMT_RET: return *static_cast<const RetStmt*>(stmt) >> out;
+	case STMT_THING: return *static_cast<const ThingStmt*>(stmt) >> out;
+	case STMT_VAR: return *static_cast<const VarStmt*>(stmt) >> out;
+	case STMT_WHILE: return *static_cast<const WhileStmt*>(stmt) >> out;
+	default: break;
+	}
+
+	if (stmt->IsExpr())
+		return out << static_cast<const Expr*>(stmt) << ';';
 
 	throw;
 }
@@ -73,7 +68,7 @@ std::ostream& csaw::ForStmt::operator>>(std::ostream& out) const
 std::ostream& csaw::FunStmt::operator>>(std::ostream& out) const
 {
 	out << (IsConstructor ? '$' : '@') << Name;
-	if (!IsConstructor && !RetType->Name.empty())
+	if (!IsConstructor && RetType && !RetType->Name.empty())
 		out << ": " << RetType;
 	out << " (";
 
@@ -88,9 +83,13 @@ std::ostream& csaw::FunStmt::operator>>(std::ostream& out) const
 	out << ") ";
 	if (IsVarArg)
 		out << "? ";
-	if (!MemberOf->Name.empty())
+	if (MemberOf && !MemberOf->Name.empty())
 		out << "-> " << MemberOf << ' ';
-	return *Body.get() >> out;
+	if (IsFast)
+		out << "fast ";
+	if (!Body)
+		return out << ';';
+	return *Body >> out;
 }
 
 std::ostream& csaw::IfStmt::operator>>(std::ostream& out) const
@@ -106,8 +105,15 @@ std::ostream& csaw::IncStmt::operator>>(std::ostream& out) const
 	return out << "inc \"" << Path << "\";";
 }
 
+std::ostream& csaw::RegionStmt::operator>>(std::ostream& out) const
+{
+	return out << "region " << Body;
+}
+
 std::ostream& csaw::RetStmt::operator>>(std::ostream& out) const
 {
+	if (!Value)
+		return out << "ret;";
 	return out << "ret " << Value << ";";
 }
 
@@ -116,6 +122,8 @@ std::ostream& csaw::ThingStmt::operator>>(std::ostream& out) const
 	out << "thing: " << Name;
 	if (!Group.empty())
 		out << " : " << Group;
+	if (IsValue)
+		out << " value";
 	if (Fields.empty())
 		return out << ';';
 	out << " {" << std::endl;
@@ -1,58 +1,115 @@
 #include "compiler.h"
 
-csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<Expr>& expr)
+#include <llvm/ADT/StringExtras.h>
+
+static csaw::value_t ShortCircuit(const std::shared_ptr<csaw::Environment>& env, bool isAnd, const csaw::value_t& left, const csaw::Expr* right)
 {
-	if (auto e = std::dynamic_pointer_cast<BinExpr>(expr))
-		return GenIR(env, e);
-	if (auto e = std::dynamic_pointer_cast<CallExpr>(expr))
-		return GenIR(env, e);
-	if (auto e = std::dynamic_pointer_cast<ChrExpr>(expr))
-		return GenIR(env, e);
-	if (auto e = std::dynamic_pointer_cast<ConExpr>(expr))
-		return GenIR(env, e);
-	if (auto e = std::dynamic_pointer_cast<IdExpr>(expr))
-		return GenIR(env, e);
-	if (auto e = std::dynamic_pointer_cast<IndexExpr>(expr))
-		return GenIR(env, e);
-	if (auto e = std::dynamic_pointer_cast<LambdaExpr>(expr))
-		return GenIR(env, e);
-	if (auto e = std::dynamic_pointer_cast<MemExpr>(expr))
-		return GenIR(env, e);
-	if (auto e = std::dynamic_pointer_cast<NumExpr>(expr))
-		return GenIR(env, e);
-	if (auto e = std::dynamic_pointer_cast<StrExpr>(expr))
-		return GenIR(env, e);
-	if (auto e = std::dynamic_pointer_cast<UnExpr>(expr))
-		return GenIR(env, e);
-	if (auto e = std::dynamic_pointer_cast<VarArgExpr>(expr))
-		return GenIR(env, e);
+	auto fun = csaw::Environment::Builder().GetInsertBlock()->getParent();
+	auto bright = llvm::BasicBlock::Create(csaw::Environment::Context(), isAnd ? "and.rhs" : "or.rhs", fun);
+	auto bexit = llvm::BasicBlock::Create(csaw::Environment::Context(), isAnd ? "and.exit" : "or.exit", fun);
+
+	auto lhs = csaw::ToBool(left());
+	auto bleft = csaw::Environment::Builder().GetInsertBlock();
+	if (isAnd) csaw::Environment::Builder().CreateCondBr(lhs, bright, bexit);
+	else csaw::Environment::Builder().CreateCondBr(lhs, bexit, bright);
+
+	csaw::Environment::Builder().SetInsertPoint(bright);
+	auto rhs = csaw::ToBool(GenIR(env, right)());
+	csaw::Environment::Builder().CreateBr(bexit);
+	bright = csaw::Environment::Builder().GetInsertBlock();
+
+	csaw::Environment::Builder().SetInsertPoint(bexit);
+	auto phi = csaw::Environment::Builder().CreatePHI(csaw::Environment::Builder().getInt1Ty(), 2);
+	phi->addIncoming(csaw::Environment::Builder().getInt1(!isAnd), bleft);
+	phi->addIncoming(rhs, bright);
+
+	return csaw::value_t(phi, csaw::type_t("bool", phi->getType()));
+}
+
+csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const Expr* expr)
+{
+	switch (expr->Kind)
+	{
+	case EXPR_BIN: return GenIR(env, static_cast<const BinExpr*>(expr));
+	case EXPR_CALL: return GenIR(env, static_cast<const CallExpr*>(expr));
+	case EXPR_CHR: return GenIR(env, static_cast<const ChrExpr*>(expr));
+	case EXPR_CON: return GenIR(env, static_cast<const ConExpr*>(expr));
+	case EXPR_ID: return GenIR(env, static_cast<const IdExpr*>(expr));
+	case EXPR_INDEX: return GenIR(env, static_cast<const IndexExpr*>(expr));
+	case EXPR_LAMBDA: return GenIR(env, static_cast<const LambdaExpr*>(expr));
+	case EXPR_MEM: return GenIR(env, static_cast<const MemExpr*>(expr));
+	case EXPR_NEW: return GenIR(env, static_cast<const NewExpr*>(expr));
+	case EXPR_NUM: return GenIR(env, static_cast<const NumExpr*>(expr));
+	case EXPR_STR: return GenIR(env, static_cast<const StrExpr*>(expr));
+	case EXPR_UN: return GenIR(env, static_cast<const UnExpr*>(expr));
+	case EXPR_VARARG: return GenIR(env, static_cast<const VarArgExpr*>(expr));
+	default: break;
+	}
 
 	throw "TODO";
 }
 
-static csaw::value_t Assign(const std::shared_ptr<csaw::Environment>& env, const std::shared_ptr<csaw::Expr>& obj, csaw::value_t value)
+static csaw::value_t Reference(const std::shared_ptr<csaw::Environment>& env, const csaw::Expr* expr)
+{ // like GenIR, but a value thing that lives in a variable or field comes back as its address
+	if (auto e = csaw::As<csaw::IdExpr>(expr))
+	{
+		auto ref = env->GetReference(e->Value);
+		if (csaw::IsValueThing(ref.ptrType))
+			return ref;
+		return GenIR(env, expr);
+	}
+
+	auto e = csaw::As<csaw::MemExpr>(expr);
+	if (!e)
+		return GenIR(env, expr);
+
+	auto object = Reference(env, e->Object);
+	auto strtype = llvm::dyn_cast<llvm::StructType>(object.ptrType.element);
+	auto type = csaw::Environment::GetType(strtype);
+
+	auto i = type->Field(e->Member);
+	if (i < 0)
+	{
+		llvm::errs() << "Undefined field '" << e->Member << "'\r\n";
+		throw;
+	}
+
+	auto& field = type->fields[i].second;
+	if (!object()->getType()->isPointerTy()) // a temporary value thing
+		return csaw::value_t(csaw::Environment::Builder().CreateExtractValue(object(), { (unsigned)i }), field);
+
+	auto ptr = csaw::Environment::Builder().CreateStructGEP(strtype, object(), i);
+	if (csaw::IsValueThing(field))
+		return csaw::value_t(ptr, field);
+	return csaw::value_t(csaw::Environment::Builder().CreateLoad(strtype->getElementType(i), ptr), field);
+}
+
+static csaw::value_t Assign(const std::shared_ptr<csaw::Environment>& env, const csaw::Expr* obj, csaw::value_t value)
 {
-	if (auto e = std::dynamic_pointer_cast<csaw::IdExpr>(obj))
+	if (auto e = csaw::As<csaw::IdExpr>(obj))
 		return env->SetVariable(e->Value, value);
 
-	if (auto e = std::dynamic_pointer_cast<csaw::MemExpr>(obj))
+	if (auto e = csaw::As<csaw::MemExpr>(obj))
 	{
-		auto object = GenIR(env, e->Object);
+		auto object = Reference(env, e->Object);
 		auto strtype = llvm::dyn_cast<llvm::StructType>(object.ptrType.element);
 		auto type = csaw::Environment::GetType(strtype);
 
-		unsigned int i = 0;
-		for (; i < type->fields.size(); i++)
-			if (type->fields[i].first == e->Member)
-				break;
-
-		if (i == type->fields.size())
+		auto i = type->Field(e->Member);
+		if (i < 0)
 		{
 			llvm::errs() << "Undefined field '" << e->Member << "'\r\n";
 			throw;
 		}
 
+		if (!object()->getType()->isPointerTy())
+		{
+			llvm::errs() << "Cannot assign to field '" << e->Member << "' of a temporary\r\n";
+			throw;
+		}
+
 		auto ptr = csaw::Environment::Builder().CreateStructGEP(strtype, object(), i);
+		value = csaw::Cast(value, type->fields[i].second);
 		csaw::Environment::Builder().CreateStore(value(), ptr);
 		return value;
 	}
@@ -60,12 +117,15 @@ static csaw::value_t Assign(const std::shared_ptr<csaw::Environment>& env, const
 	throw "TODO";
 }
 
-csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<BinExpr>& expr)
+csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const BinExpr* expr)
 {
 	std::string op = expr->Operator;
 	bool assign = op.find_last_of('=') == 1 && !(op == "==" || op == "!=" || op == "<=" || op == ">=");
 
-	auto left = GenIR(env, expr->Left);
+	auto left = assign ? Reference(env, expr->Left) : GenIR(env, expr->Left); // so that e.g. += changes a value thing in place
+	if ((op == "&&" || op == "||") && IsPrimitive(left.ptrType))
+		return ShortCircuit(env, op == "&&", left, expr->Right);
+
 	auto right = GenIR(env, expr->Right);
 
 	auto value = Environment::CreateCall(assign ? left.ptrType : type_t(), expr->Operator, { left, right }, true);
@@ -124,18 +184,28 @@ csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const std::sh
 	return value;
 }
 
-csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<CallExpr>& expr)
+csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const CallExpr* expr)
 {
 	std::vector<value_t> args;
 	for (auto& arg : expr->Arguments)
 		args.push_back(GenIR(env, arg));
 
-	if (auto e = std::dynamic_pointer_cast<IdExpr>(expr->Function))
+	if (auto e = As<IdExpr>(expr->Function))
+	{
+		// i32(x), num(x), ... convert between numeric types unless user code overloads them
+		if (args.size() == 1 && IsPrimitive(args[0].ptrType) && IsNumeric(e->Value))
+		{
+			if (auto value = Environment::CreateCall(type_t(), e->Value, args, true))
+				return value;
+			return Cast(args[0], GenIR(e->Value));
+		}
+
 		return Environment::CreateCall(type_t(), e->Value, args);
+	}
 
-	if (auto e = std::dynamic_pointer_cast<MemExpr>(expr->Function))
+	if (auto e = As<MemExpr>(expr->Function))
 	{
-		auto object = GenIR(env, e->Object);
+		auto object = Reference(env, e->Object);
 		args.insert(args.begin(), object);
 		return Environment::CreateCall(object.ptrType, e->Member, args);
 	}
@@ -143,12 +213,12 @@ csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const std::sh
 	throw "TODO";
 }
 
-csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<ChrExpr>& expr)
+csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const ChrExpr* expr)
 {
 	return value_t(Environment::Builder().getInt8(expr->Value), type_t("chr", Environment::Builder().getInt8Ty()));
 }
 
-csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<ConExpr>& expr)
+csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const ConExpr* expr)
 {
 	auto fun = Environment::Builder().GetInsertBlock()->getParent();
 	auto bthen = llvm::BasicBlock::Create(Environment::Context(), "then");
@@ -156,31 +226,38 @@ csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const std::sh
 	auto bmerge = llvm::BasicBlock::Create(Environment::Context(), "merge");
 
 	auto condition = GenIR(env, expr->Condition);
-	condition.value = NumToBool(condition());
+	condition.value = ToBool(condition());
 	Environment::Builder().CreateCondBr(condition(), bthen, belse);
 
 	fun->insert(fun->end(), bthen);
 	Environment::Builder().SetInsertPoint(bthen);
 	auto vthen = GenIR(env, expr->Then);
-	Environment::Builder().CreateBr(bmerge);
 	bthen = Environment::Builder().GetInsertBlock();
 
 	fun->insert(fun->end(), belse);
 	Environment::Builder().SetInsertPoint(belse);
 	auto velse = GenIR(env, expr->Else);
-	Environment::Builder().CreateBr(bmerge);
 	belse = Environment::Builder().GetInsertBlock();
 
+	// both branches end in the common type, each cast in its own block
+	auto type = IsPrimitive(vthen.ptrType) && IsPrimitive(velse.ptrType) ? Common(vthen, velse) : vthen.ptrType;
+	velse = Cast(velse, type);
+	Environment::Builder().CreateBr(bmerge);
+
+	Environment::Builder().SetInsertPoint(bthen);
+	vthen = Cast(vthen, type);
+	Environment::Builder().CreateBr(bmerge);
+
 	fun->insert(fun->end(), bmerge);
 	Environment::Builder().SetInsertPoint(bmerge);
-	auto phi = Environment::Builder().CreatePHI(vthen()->getType(), 2);
+	auto phi = Environment::Builder().CreatePHI(type.type, 2);
 	phi->addIncoming(vthen(), bthen);
 	phi->addIncoming(velse(), belse);
 
-	return value_t(phi, vthen.ptrType);
+	return value_t(phi, type);
 }
 
-csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<IdExpr>& expr)
+csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const IdExpr* expr)
 {
 	auto value = env->GetVariable(expr->Value);
 	if (auto global = llvm::dyn_cast<llvm::GlobalValue>(value()))
@@ -188,7 +265,7 @@ csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const std::sh
 	return value;
 }
 
-csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<IndexExpr>& expr)
+csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const IndexExpr* expr)
 {
 	auto object = GenIR(env, expr->Object);
 	auto index = GenIR(env, expr->Index);
@@ -199,46 +276,54 @@ csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const std::sh
 	throw "TODO";
 }
 
-csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<LambdaExpr>& expr)
+csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const LambdaExpr* expr)
 {
 	throw "TODO";
 }
 
-csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<MemExpr>& expr)
+csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const MemExpr* expr)
 {
-	auto object = GenIR(env, expr->Object);
-	auto strtype = llvm::dyn_cast<llvm::StructType>(object.ptrType.element);
-	auto type = Environment::GetType(strtype);
-
-	unsigned int i = 0;
-	for (; i < type->fields.size(); i++)
-		if (type->fields[i].first == expr->Member)
-			break;
+	auto value = Reference(env, expr);
+	if (IsValueThing(value.ptrType) && value()->getType()->isPointerTy())
+		return value_t(Environment::Builder().CreateLoad(value.ptrType.type, value()), value.ptrType);
+	return value;
+}
 
-	if (i == type->fields.size())
-	{
-		llvm::errs() << "Undefined field '" << expr->Member << "'\r\n";
-		throw;
-	}
+csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const NewExpr* expr)
+{
+	std::vector<value_t> args;
+	for (auto& arg : expr->Arguments)
+		args.push_back(GenIR(env, arg));
 
-	auto ptr = Environment::Builder().CreateStructGEP(strtype, object(), i);
-	return value_t(Environment::Builder().CreateLoad(strtype->getElementType(i), ptr), type->fields[i].second);
+	return Environment::CreateNew(expr->Type, args);
 }
 
-csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<NumExpr>& expr)
+csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const NumExpr* expr)
 {
 	auto dty = Environment::Builder().getDoubleTy();
 	return value_t(llvm::ConstantFP::get(dty, expr->Value), type_t("num", dty));
 }
 
-csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<StrExpr>& expr)
-{
+csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const StrExpr* expr)
+{ // laid out like a runtime string, the length in front of the chars, and emitted once per module
 	auto i8 = Environment::Builder().getInt8Ty();
-	auto str = Environment::Builder().CreateGlobalStringPtr(expr->Value, "str");
+	auto name = "str." + llvm::toHex(llvm::SHA1::hash(llvm::arrayRefFromStringRef(expr->Value)), true);
+
+	auto global = Environment::Module().getNamedGlobal(name);
+	if (!global)
+	{
+		auto length = llvm::ConstantInt::get(Environment::Builder().getInt64Ty(), expr->Value.size());
+		auto init = llvm::ConstantStruct::getAnon({ length, llvm::ConstantDataArray::getString(Environment::Context(), expr->Value) });
+		global = new llvm::GlobalVariable(Environment::Module(), init->getType(), true, llvm::GlobalValue::PrivateLinkage, init, name);
+		global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+		global->setAlignment(llvm::Align(8));
+	}
+
+	auto str = Environment::Builder().CreateConstInBoundsGEP2_32(global->getValueType(), global, 0, 1);
 	return value_t(str, type_t("str", str->getType(), i8));
 }
 
-csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<UnExpr>& expr)
+csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const UnExpr* expr)
 {
 	auto val = GenIR(env, expr->Value);
 
@@ -265,7 +350,7 @@ csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const std::sh
 	return value;
 }
 
-csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<VarArgExpr>& expr)
+csaw::value_t csaw::GenIR(const std::shared_ptr<Environment>& env, const VarArgExpr* expr)
 {
 	if (!expr->Type)
 		return value_t(env->GetVarArgs(), type_t("any", Environment::Builder().getPtrTy()));
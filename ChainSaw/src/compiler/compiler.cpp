@@ -1,5 +1,7 @@
 #include "compiler.h"
 
+#include <llvm/ADT/APSInt.h>
+
 csaw::type_t csaw::GenIR(const std::shared_ptr<ASTType>& type)
 {
 	if (auto t = std::dynamic_pointer_cast<ASTArrayType>(type))
@@ -13,29 +15,47 @@ csaw::type_t csaw::GenIR(const std::shared_ptr<ASTType>& type)
 
 csaw::type_t csaw::GenIR(const std::string& type)
 {
-	// any = opaque*
-	// num = double
-	// chr = i8
-	// str = i8*
-	// {}  = {}*
+	// any  = opaque*
+	// bool = i1
+	// num  = double
+	// f32  = float
+	// i32  = i32
+	// i64  = i64
+	// u8   = i8
+	// chr  = i8
+	// str  = i8*, with the length in the 8 bytes in front of the chars
+	// cstr = i8*, a plain C string, as returned by C functions
+	// {}   = {}*
 
-	if (Environment::HasAlias(type))
-		return Environment::GetAlias(type);
+	if (auto alias = Environment::GetAlias(type))
+		return *alias;
 
 	if (type == "any")
 		return type_t(type, Environment::Builder().getPtrTy());
+	if (type == "bool")
+		return type_t(type, Environment::Builder().getInt1Ty());
 	if (type == "num")
 		return type_t(type, Environment::Builder().getDoubleTy());
-	if (type == "chr")
+	if (type == "f32")
+		return type_t(type, Environment::Builder().getFloatTy());
+	if (type == "i32")
+		return type_t(type, Environment::Builder().getInt32Ty());
+	if (type == "i64")
+		return type_t(type, Environment::Builder().getInt64Ty());
+	if (type == "u8" || type == "chr")
 		return type_t(type, Environment::Builder().getInt8Ty());
-	if (type == "str")
+	if (type == "str" || type == "cstr")
 	{
 		auto i8ty = Environment::Builder().getInt8Ty();
 		return type_t(type, llvm::PointerType::get(i8ty, 0), i8ty);
 	}
 
 	if (auto t = Environment::GetType(type))
+	{
+		if (t->value) // passed around as the struct itself, so mem2reg and SROA can keep it in registers
+			return type_t(type, t->type, t->type);
 		return type_t(type, llvm::PointerType::get(t->type, 0), t->type);
+	}
 
 	llvm::errs() << "Undefined type '" << type << "'\r\n";
 	throw;
@@ -47,14 +67,180 @@ csaw::type_t csaw::GenIR(const std::shared_ptr<ASTArrayType>& type)
 	return type_t(t.name, llvm::ArrayType::get(t.type, type->Size), t.element);
 }
 
-llvm::Value* csaw::BoolToNum(llvm::Value* value)
+unsigned csaw::Intern(const std::string& name)
+{
+	// open addressing over the interned names, slots hold id + 1 (0 = empty)
+	static std::vector<std::string> names;
+	static std::vector<unsigned> slots(256);
+
+	auto hash = std::hash<std::string>()(name);
+	auto mask = slots.size() - 1;
+	for (auto i = hash & mask;; i = (i + 1) & mask)
+	{
+		if (!slots[i])
+			break;
+		if (names[slots[i] - 1] == name)
+			return slots[i] - 1;
+	}
+
+	if ((names.size() + 1) * 2 > slots.size())
+	{
+		std::vector<unsigned> grown(slots.size() * 2);
+		mask = grown.size() - 1;
+		for (unsigned id = 0; id < names.size(); id++)
+		{
+			auto j = std::hash<std::string>()(names[id]) & mask;
+			while (grown[j])
+				j = (j + 1) & mask;
+			grown[j] = id + 1;
+		}
+		slots = std::move(grown);
+	}
+
+	auto i = hash & mask;
+	while (slots[i])
+		i = (i + 1) & mask;
+
+	names.push_back(name);
+	slots[i] = (unsigned)names.size();
+	return (unsigned)names.size() - 1;
+}
+
+unsigned csaw::TypeId(const std::string& name, llvm::Type* type)
+{
+	// one id per distinct (name, type) pair, 0 is left for the empty type_t
+	static std::vector<std::vector<std::pair<llvm::Type*, unsigned>>> ids; // interned name -> types seen under it
+	static unsigned next = 1;
+
+	auto nameid = Intern(name);
+	if (nameid >= ids.size())
+		ids.resize(nameid + 1);
+
+	for (auto& entry : ids[nameid])
+		if (entry.first == type)
+			return entry.second;
+
+	ids[nameid].emplace_back(type, next);
+	return next++;
+}
+
+std::string csaw::Describe(const type_t& type)
+{ // the name does not carry array extents, so they are appended
+	auto description = type.name;
+	for (auto t = type.type; auto array = llvm::dyn_cast_or_null<llvm::ArrayType>(t); t = array->getElementType())
+		description += '[' + std::to_string(array->getNumElements()) + ']';
+	return description;
+}
+
+bool csaw::IsNumeric(const std::string& type)
+{
+	return type == "bool" || type == "num" || type == "f32" || type == "i32" || type == "i64" || type == "u8" || type == "chr";
+}
+
+bool csaw::IsPrimitive(const type_t& type)
+{
+	return type.type && (type.type->isIntegerTy() || type.type->isFloatingPointTy());
+}
+
+bool csaw::IsValueThing(const type_t& type)
+{
+	return type.type && type.type->isStructTy();
+}
+
+bool csaw::IsSigned(const type_t& type)
+{
+	return !(type.name == "bool" || type.name == "u8" || type.name == "chr");
+}
+
+static bool Fits(const llvm::ConstantFP* literal, const csaw::type_t& type)
+{ // whether the literal is exactly representable in the type, so casting it is no poison
+	if (type.type->isFloatingPointTy())
+		return true;
+
+	llvm::APSInt value(type.type->getIntegerBitWidth(), !csaw::IsSigned(type));
+	bool exact;
+	return literal->getValueAPF().convertToInteger(value, llvm::APFloat::rmTowardZero, &exact) == llvm::APFloat::opOK && exact;
+}
+
+bool csaw::Converts(const value_t& value, const type_t& type)
+{
+	auto src = value.ptrType.type;
+	auto dst = type.type;
+
+	if (value.ptrType == type)
+		return true;
+	if (value.ptrType.name == "str" && type.name == "cstr") // a str is NUL terminated, C reads it as is
+		return true;
+	if (!IsPrimitive(value.ptrType) || !IsPrimitive(type))
+		return false;
+
+	// literals convert wherever they fit without losing their value
+	if (auto fp = llvm::dyn_cast<llvm::ConstantFP>(value()))
+		return Fits(fp, type);
+
+	if (src->isFloatingPointTy())
+		return dst->isFloatingPointTy() && dst->getPrimitiveSizeInBits() >= src->getPrimitiveSizeInBits();
+	if (dst->isFloatingPointTy())
+		return true;
+	return dst->getPrimitiveSizeInBits() > src->getPrimitiveSizeInBits() || (dst->getPrimitiveSizeInBits() == src->getPrimitiveSizeInBits() && IsSigned(type) == IsSigned(value.ptrType));
+}
+
+csaw::type_t csaw::Common(const value_t& left, const value_t& right)
 {
-	return Environment::Builder().CreateUIToFP(value, llvm::Type::getDoubleTy(Environment::Context()));
+	// a literal takes the type of a non-literal operand, so 'i + 1' stays integer and 'x * 0.5' stays f32
+	auto adapts = [](const value_t& literal, const value_t& other)
+	{
+		auto fp = llvm::dyn_cast<llvm::ConstantFP>(literal());
+		if (!fp || llvm::isa<llvm::Constant>(other()) || other.ptrType.type->isIntegerTy(1))
+			return false;
+		return Fits(fp, other.ptrType);
+	};
+
+	if (adapts(right, left))
+		return left.ptrType;
+	if (adapts(left, right))
+		return right.ptrType;
+
+	auto l = left.ptrType.type;
+	auto r = right.ptrType.type;
+	if (l->isFloatingPointTy() != r->isFloatingPointTy())
+		return l->isFloatingPointTy() ? left.ptrType : right.ptrType;
+	return l->getPrimitiveSizeInBits() >= r->getPrimitiveSizeInBits() ? left.ptrType : right.ptrType;
+}
+
+csaw::value_t csaw::Cast(const value_t& value, const type_t& type)
+{
+	if (value.ptrType.name == "str" && type.name == "cstr")
+		return value_t(value(), type);
+	if (value.ptrType == type || !IsPrimitive(value.ptrType) || !IsPrimitive(type))
+		return value;
+
+	auto src = value.ptrType.type;
+	auto dst = type.type;
+
+	llvm::Value* result;
+	if (dst->isIntegerTy(1))
+		result = ToBool(value());
+	else if (src->isFloatingPointTy() && dst->isFloatingPointTy())
+		result = Environment::Builder().CreateFPCast(value(), dst);
+	else if (src->isFloatingPointTy())
+		result = IsSigned(type) ? Environment::Builder().CreateFPToSI(value(), dst) : Environment::Builder().CreateFPToUI(value(), dst);
+	else if (dst->isFloatingPointTy())
+		result = IsSigned(value.ptrType) ? Environment::Builder().CreateSIToFP(value(), dst) : Environment::Builder().CreateUIToFP(value(), dst);
+	else
+		result = Environment::Builder().CreateIntCast(value(), dst, IsSigned(value.ptrType));
+
+	return value_t(result, type);
 }
 
-llvm::Value* csaw::NumToBool(llvm::Value* value)
+llvm::Value* csaw::ToBool(llvm::Value* value)
 {
-	return Environment::Builder().CreateFPToUI(value, llvm::Type::getInt1Ty(Environment::Context()));
+	auto type = value->getType();
+	if (type->isIntegerTy(1))
+		return value;
+	if (type->isFloatingPointTy())
+		return Environment::Builder().CreateFCmpUNE(value, llvm::ConstantFP::get(type, 0.0));
+	return Environment::Builder().CreateIsNotNull(value);
 }
 
 llvm::Value* csaw::IntToNum(llvm::Value* value)
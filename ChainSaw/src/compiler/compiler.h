@@ -1,17 +1,22 @@
 #pragma once
 
 #include "../ast/ast.h"
+#include "interface.h"
 
 #include <filesystem>
 #include <map>
+#include <set>
+#include <unordered_map>
 
-#include <llvm/Analysis/CGSCCPassManager.h>
-#include <llvm/Analysis/LoopAnalysisManager.h>
 #include <llvm/IR/IRBuilder.h>
-#include <llvm/Passes/StandardInstrumentations.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Target/TargetMachine.h>
 
 namespace csaw
 {
+	unsigned Intern(const std::string& name);
+	unsigned TypeId(const std::string& name, llvm::Type* type);
+
 	struct type_t
 	{
 		type_t()
@@ -20,35 +25,33 @@ namespace csaw
 
 		type_t(const std::string& name, llvm::Type* type)
 		{
+			this->id = TypeId(name, type);
 			this->name = name;
 			this->type = type;
 		}
 
 		type_t(const std::string& name, llvm::Type* type, llvm::Type* element)
 		{
+			this->id = TypeId(name, type);
 			this->name = name;
 			this->type = type;
 			this->element = element;
 		}
 
+		unsigned id = 0; // interned (name, type) identity, 0 for no type
 		std::string name;
 		llvm::Type* type = nullptr;
 		llvm::Type* element = nullptr;
 	};
 
-	inline bool operator!=(const type_t& a, const type_t& b)
-	{
-		return a.name != b.name || a.type != b.type || (!(a.type->isPointerTy() && !a.element) && a.element != b.element);
-	}
+	inline bool operator==(const type_t& a, const type_t& b) { return a.id == b.id; }
+	inline bool operator!=(const type_t& a, const type_t& b) { return a.id != b.id; }
+	inline bool operator<(const type_t& a, const type_t& b) { return a.id < b.id; }
 
-	inline bool operator<(const type_t& a, const type_t& b)
+	struct type_hash
 	{
-		if (!a.type) return b.type;
-		if (!b.type) return false;
-		if (!a.element) return b.element;
-		if (!b.element) return false;
-		return a.type < b.type;
-	}
+		size_t operator()(const type_t& type) const { return type.id; }
+	};
 
 	struct value_t
 	{
@@ -82,91 +85,204 @@ namespace csaw
 		bool isconstructor = false;
 	};
 
+	struct call_t // overload memo key: receiver, interned name and argument signature
+	{
+		type_t memberof;
+		unsigned name = 0;
+		std::vector<type_t> argtypes;
+	};
+
+	inline bool operator==(const call_t& a, const call_t& b)
+	{
+		return a.name == b.name && a.memberof == b.memberof && a.argtypes == b.argtypes;
+	}
+
+	struct call_hash
+	{
+		size_t operator()(const call_t& call) const
+		{
+			size_t hash = (size_t)call.memberof.id * 31 + call.name;
+			for (auto& type : call.argtypes)
+				hash = hash * 31 + type.id;
+			return hash;
+		}
+	};
+
+	struct symbol_t
+	{
+		unsigned name = 0; // interned name id
+		value_t value;
+		int shadowed = -1; // previous innermost symbol with the same name, -1 if none
+	};
+
 	struct thing_t
 	{
+		int Field(const std::string& name) const
+		{
+			auto entry = index.find(Intern(name));
+			return entry == index.end() ? -1 : entry->second;
+		}
+
 		llvm::StructType* type = nullptr;
 		std::vector<std::pair<std::string, type_t>> fields;
+		std::unordered_map<unsigned, int> index; // interned field name -> position in fields
+		bool value = false; // a value thing: held as the struct itself, not as a pointer to it
+	};
+
+	struct unit_t // an included file, generated into its own module
+	{
+		std::string key; // hash of its source and of everything declared before it
+		std::string path; // canonical path
+		std::string hash; // hash of its source
+		llvm::Module* parent = nullptr; // module of the including file
+		llvm::Function* global = nullptr; // global initializer of the including file
+		llvm::IRBuilderBase::InsertPoint ip; // where the including file left off
+		bool cached = false; // module loaded from the cache, only its interface is replayed
+		std::shared_ptr<interface_t> iface; // loaded if cached, recorded while generating otherwise
+	};
+
+	enum JITMode
+	{
+		JIT_EAGER, // whole module compiled up front
+		JIT_LAZY, // each function compiled on its first call
+		JIT_TIERED, // unoptimized first, hot functions recompiled at -O3 in the background
+	};
+
+	enum OptStage
+	{
+		OPT_FULL, // the whole default pipeline
+		OPT_SIMPLIFY, // inlining and other cross-function simplification, needs the whole module
+		OPT_LATE, // per-function optimization and vectorization, safe to run on a partition
 	};
 
 	class Environment
 	{
 	public:
-		Environment(const std::shared_ptr<Environment>& parent)
-			: m_Parent(parent) {}
-
 		Environment(const std::filesystem::path& path)
-			: Environment(std::shared_ptr<Environment>())
-		{
-			m_Path = path;
-		}
+			: m_Path(path) {}
+
+		void PushScope();
+		void PopScope();
 
 		value_t CreateVariable(const std::string& name, const value_t& value, bool isGlobal = false);
 		value_t SetVariable(const std::string& name, const value_t& value);
 		value_t GetVariable(const std::string& name);
+		value_t GetReference(const std::string& name);
+
+		const type_t& Result() const { return m_Result; }
+		void Result(const type_t& type) { m_Result = type; }
 
 		llvm::Value* SetVarArgs(llvm::Value* valist);
 		llvm::Value* GetVarArgs();
 
-		bool IsTopLevel() const { return !m_Parent.get(); }
+		void PushRegion(llvm::Value* region) { m_Regions.push_back(region); }
+		void PopRegion() { m_Regions.pop_back(); }
+		llvm::Value* OuterRegion() const { return m_Regions.empty() ? nullptr : m_Regions.front(); }
+
+		bool IsTopLevel() const { return m_Scopes.empty(); }
 		std::filesystem::path Path() const { return m_Path; }
 		void Path(const std::filesystem::path& path) { m_Path = path; }
 
 	private:
-		value_t& GetVar(const std::string& name);
+		value_t GetVar(const std::string& name); // by value, a later declaration may move m_Symbols
 
 	private:
 		std::filesystem::path m_Path;
-		std::shared_ptr<Environment> m_Parent;
-		std::map<std::string, value_t> m_Variables;
+		std::vector<symbol_t> m_Symbols; // every visible variable, innermost scope last
+		std::vector<int> m_Innermost; // interned name id -> index into m_Symbols, -1 if undefined
+		std::vector<size_t> m_Scopes; // size of m_Symbols when each open scope was pushed
 		llvm::Value* m_VarArgs = nullptr;
+		std::vector<llvm::Value*> m_Regions; // marks of the regions open around the code being generated
+		type_t m_Result; // return type of the function being generated
 
 	public:
 		static void InitEnvironment();
 
+		static bool Include(const std::filesystem::path& path);
+		static const interface_t* BeginUnit(const std::filesystem::path& path, const std::string& source);
+		static void EndUnit();
+		static void Link();
+		static llvm::Value* Import(llvm::Value* value);
+		static llvm::Function* GlobalFunction() { return m_Global; }
+
 		static void CreateFunction(const type_t& memberof, const std::string& name, const fun_t& fun);
 		static fun_t GetFunction(const type_t& memberof, const std::string& name, const std::vector<type_t>& argtypes);
 
-		static void CreateType(const std::string& name, llvm::StructType* type, const std::vector<std::pair<std::string, type_t>>& fields);
+		static void CreateType(const std::string& name, llvm::StructType* type, const std::vector<std::pair<std::string, type_t>>& fields, bool isValue = false);
 		static const thing_t* GetType(const std::string& name);
 		static const thing_t* GetType(llvm::StructType* strtype);
 
 		static void CreateAlias(const std::string& alias, const type_t& origin);
-		static bool HasAlias(const std::string& alias);
-		static const type_t& GetAlias(const std::string& alias);
+		static const type_t* GetAlias(const std::string& alias);
 
 		static value_t GetNull(const type_t& type);
+		static void HoistObjects(llvm::Function& fun);
+		static value_t GetNew(const type_t& type);
 
 		static value_t CreateCall(const type_t& memberof, const std::string& name, const std::vector<value_t>& args, bool justAsking = false);
+		static value_t CreateNew(const std::string& name, const std::vector<value_t>& args);
 		static value_t NextVarArg(const type_t& type, llvm::Value* vaptr);
-		static void Optimize(llvm::Function* function) { m_FPM->run(*function, *m_FAM); }
+		static void Optimize(llvm::Module& module, llvm::TargetMachine* machine, unsigned level, const OptStage stage = OPT_FULL);
+
+		static unsigned OptLevel() { return m_OptLevel; }
+		static void OptLevel(unsigned level) { m_OptLevel = level; }
 
-		static double Run();
-		static void Compile(const std::string& filename);
+		static void Target(const std::string& cpu, const std::string& features);
+		static void FPContract(const std::string& mode);
+		static void FastMath(bool enable);
+		static bool FastMath() { return m_FastMath; }
+
+		static void CacheDir(const std::filesystem::path& directory) { m_CacheDir = directory; }
+		static void TierThreshold(unsigned calls) { m_TierThreshold = calls; }
+		static void Jobs(unsigned count) { m_Jobs = count ? count : 1; }
+		static void GC(bool enable) { m_GC = enable; }
+		static bool GC() { return m_GC; }
+
+		static double Run(const JITMode mode = JIT_EAGER);
+		static bool Compile(const std::string& filename);
 
 		static llvm::LLVMContext& Context() { return *m_Context; }
 		static llvm::IRBuilder<>& Builder() { return *m_Builder; }
-		static llvm::Module& Module() { return *m_Module; }
+		static llvm::Module& Module() { return *m_Current; }
 
 	private:
-		static void CreateGlobalFunction();
+		static const fun_t* FindFunction(const type_t& memberof, const std::string& name, const std::vector<type_t>& argtypes);
+		static const fun_t* FindConvertible(const type_t& memberof, const std::string& name, const std::vector<value_t>& args);
+		static value_t Invoke(const fun_t* fun, const type_t& memberof, const std::vector<value_t>& args, llvm::Value* my);
+
+		static void DefineIntrinsics();
+		static void CreateGlobalFunction(const std::string& name);
 		static void FinishGlobalFunction();
 
+		static void Export(const decl_t& decl);
+
 	private:
-		static std::map<type_t, std::map<std::string, std::vector<fun_t>>> m_Functions;
+		static std::unordered_map<type_t, std::unordered_map<unsigned, std::vector<fun_t>>, type_hash> m_Functions;
+		static std::unordered_map<call_t, const fun_t*, call_hash> m_Calls; // resolved overloads, nullptr for known misses
 		static std::map<std::string, thing_t> m_Types;
-		static std::map<std::string, type_t> m_Alias;
+		static std::unordered_map<llvm::StructType*, const thing_t*> m_Structs; // reverse index into m_Types
+		static std::unordered_map<unsigned, type_t> m_Alias; // interned alias name -> resolved origin
 
 		static std::unique_ptr<llvm::LLVMContext> m_Context;
 		static std::unique_ptr<llvm::IRBuilder<>> m_Builder;
 		static std::unique_ptr<llvm::Module> m_Module;
-
-		static std::unique_ptr<llvm::FunctionPassManager> m_FPM;
-		static std::unique_ptr<llvm::LoopAnalysisManager> m_LAM;
-		static std::unique_ptr<llvm::FunctionAnalysisManager> m_FAM;
-		static std::unique_ptr<llvm::CGSCCAnalysisManager> m_CGAM;
-		static std::unique_ptr<llvm::ModuleAnalysisManager> m_MAM;
-		static std::unique_ptr<llvm::PassInstrumentationCallbacks> m_PIC;
-		static std::unique_ptr<llvm::StandardInstrumentations> m_SI;
+		static llvm::Module* m_Current; // module of the file being generated
+		static llvm::Function* m_Global; // global initializer of the file being generated
+
+		static std::set<std::filesystem::path> m_Included; // each file is generated once
+		static std::vector<unit_t> m_Open; // included files being generated, innermost last
+		static std::vector<std::unique_ptr<llvm::Module>> m_Units; // one module per included file, linked into m_Module at the end
+		static llvm::SHA1 m_Interface; // everything declared so far, later files are generated against it
+
+		static unsigned m_OptLevel; // 0..3, like -O0..-O3
+		static std::string m_CPU; // empty or "native" = host cpu
+		static std::string m_Features; // empty = host features when targeting the host cpu
+		static llvm::TargetOptions m_TargetOptions;
+		static bool m_FastMath; // every function behaves as if marked 'fast'
+		static std::filesystem::path m_CacheDir; // jit object and file module cache, disabled if empty
+		static unsigned m_TierThreshold; // calls before a tiered function is promoted
+		static unsigned m_Jobs; // optimization and codegen threads, 1 = serial
+		static bool m_GC; // 'new' allocates from the collected heap instead of the bump allocator
 	};
 
 	// GenIR for Types
@@ -175,32 +291,35 @@ namespace csaw
 	type_t GenIR(const std::shared_ptr<ASTArrayType>& type);
 
 	// GenIR for Statements
-	void GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<Stmt>& stmt);
-	void GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<AliasStmt>& stmt);
-	void GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<EnclosedStmt>& stmt);
-	void GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<ForStmt>& stmt);
-	void GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<FunStmt>& stmt);
-	void GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<IfStmt>& stmt);
-	void GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<IncStmt>& stmt);
-	void GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<RetStmt>& stmt);
-	void GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<ThingStmt>& stmt);
-	void GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<VarStmt>& stmt);
-	void GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<WhileStmt>& stmt);
+	void GenIR(const std::shared_ptr<Environment>& env, const Stmt* stmt);
+	void Declare(const std::shared_ptr<Environment>& env, const decl_t& decl);
+	void GenIR(const std::shared_ptr<Environment>& env, const AliasStmt* stmt);
+	void GenIR(const std::shared_ptr<Environment>& env, const EnclosedStmt* stmt);
+	void GenIR(const std::shared_ptr<Environment>& env, const ForStmt* stmt);
+	void GenIR(const std::shared_ptr<Environment>& env, const FunStmt* stmt);
+	void GenIR(const std::shared_ptr<Environment>& env, const IfStmt* stmt);
+	void GenIR(const std::shared_ptr<Environment>& env, const IncStmt* stmt);
+	void GenIR(const std::shared_ptr<Environment>& env, const RegionStmt* stmt);
+	void GenIR(const std::shared_ptr<Environment>& env, const RetStmt* stmt);
+	void GenIR(const std::shared_ptr<Environment>& env, const ThingStmt* stmt);
+	void GenIR(const std::shared_ptr<Environment>& env, const VarStmt* stmt);
+	void GenIR(const std::shared_ptr<Environment>& env, const WhileStmt* stmt);
 
 	// GenIR for Expressions
-	value_t GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<Expr>& expr);
-	value_t GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<BinExpr>& expr);
-	value_t GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<CallExpr>& expr);
-	value_t GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<ChrExpr>& expr);
-	value_t GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<ConExpr>& expr);
-	value_t GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<IdExpr>& expr);
-	value_t GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<IndexExpr>& expr);
-	value_t GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<LambdaExpr>& expr);
-	value_t GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<MemExpr>& expr);
-	value_t GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<NumExpr>& expr);
-	value_t GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<StrExpr>& expr);
-	value_t GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<UnExpr>& expr);
-	value_t GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<VarArgExpr>& expr);
+	value_t GenIR(const std::shared_ptr<Environment>& env, const Expr* expr);
+	value_t GenIR(const std::shared_ptr<Environment>& env, const BinExpr* expr);
+	value_t GenIR(const std::shared_ptr<Environment>& env, const CallExpr* expr);
+	value_t GenIR(const std::shared_ptr<Environment>& env, const ChrExpr* expr);
+	value_t GenIR(const std::shared_ptr<Environment>& env, const ConExpr* expr);
+	value_t GenIR(const std::shared_ptr<Environment>& env, const IdExpr* expr);
+	value_t GenIR(const std::shared_ptr<Environment>& env, const IndexExpr* expr);
+	value_t GenIR(const std::shared_ptr<Environment>& env, const LambdaExpr* expr);
+	value_t GenIR(const std::shared_ptr<Environment>& env, const MemExpr* expr);
+	value_t GenIR(const std::shared_ptr<Environment>& env, const NewExpr* expr);
+	value_t GenIR(const std::shared_ptr<Environment>& env, const NumExpr* expr);
+	value_t GenIR(const std::shared_ptr<Environment>& env, const StrExpr* expr);
+	value_t GenIR(const std::shared_ptr<Environment>& env, const UnExpr* expr);
+	value_t GenIR(const std::shared_ptr<Environment>& env, const VarArgExpr* expr);
 
 	// Predefined Binary Operators
 	value_t OpAdd(value_t left, value_t right);
@@ -227,8 +346,17 @@ namespace csaw
 	value_t OpNeg(value_t value);
 	value_t OpInv(value_t value);
 
-	llvm::Value* BoolToNum(llvm::Value* value);
-	llvm::Value* NumToBool(llvm::Value* value);
+	// Numeric Types and Conversions
+	std::string Describe(const type_t& type);
+	bool IsNumeric(const std::string& type);
+	bool IsPrimitive(const type_t& type);
+	bool IsValueThing(const type_t& type);
+	bool IsSigned(const type_t& type);
+	bool Converts(const value_t& value, const type_t& type);
+	type_t Common(const value_t& left, const value_t& right);
+	value_t Cast(const value_t& value, const type_t& type);
+
+	llvm::Value* ToBool(llvm::Value* value);
 	llvm::Value* IntToNum(llvm::Value* value);
 	llvm::Value* NumToInt(llvm::Value* value);
 }
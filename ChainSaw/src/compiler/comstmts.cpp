@@ -4,124 +4,242 @@
 #include <iostream>
 #include <llvm/IR/Verifier.h>
 
-void csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<Stmt>& stmt)
+static std::string Mangle(const csaw::type_t& memberof, const std::string& name, const std::vector<csaw::type_t>& argtypes)
+{ // overloads defined in different files end up in different modules, so their symbols must not depend on declaration order
+	auto mangled = (memberof.name.empty() ? "" : csaw::Describe(memberof) + '.') + name + '(';
+	for (size_t i = 0; i < argtypes.size(); i++)
+		mangled += (i ? "," : "") + csaw::Describe(argtypes[i]);
+	return mangled + ')';
+}
+
+static llvm::Type* Receiver(const csaw::type_t& memberof)
+{ // members of a value thing get "my" by address, so they can change it in place
+	return csaw::IsValueThing(memberof) ? csaw::Environment::Builder().getPtrTy() : memberof.type;
+}
+
+static csaw::fun_t Signature(const csaw::FunStmt* stmt)
+{ // find or create the function's declaration
+	std::vector<llvm::Type*> types;
+	std::vector<csaw::type_t> argtypes;
+
+	auto ret = csaw::GenIR(stmt->RetType);
+
+	csaw::type_t memberof;
+	if (stmt->MemberOf)
+	{
+		memberof = csaw::GenIR(stmt->MemberOf);
+		types.push_back(Receiver(memberof));
+		argtypes.push_back(memberof);
+	}
+	else if (stmt->IsConstructor)
+	{
+		types.push_back(ret.type);
+	}
+
+	for (auto& parameter : stmt->Parameters)
+	{
+		auto param = csaw::GenIR(parameter.Type);
+		types.push_back(param.type);
+		argtypes.push_back(param);
+	}
+
+	auto fun = csaw::Environment::GetFunction(memberof, stmt->Name, argtypes);
+	if (!fun)
+	{
+		// bodyless declarations bind to runtime symbols and keep their plain name
+		auto name = stmt->Body && stmt->Name != "main" ? Mangle(memberof, stmt->Name, argtypes) : stmt->Name;
+		auto funtype = llvm::FunctionType::get(ret.type, types, stmt->IsVarArg);
+		fun.fun = llvm::Function::Create(funtype, llvm::Function::ExternalLinkage, name, csaw::Environment::Module());
+		fun.type = ret;
+		fun.argtypes = argtypes;
+		fun.isconstructor = stmt->IsConstructor;
+		csaw::Environment::CreateFunction(memberof, stmt->Name, fun);
+	}
+
+	return fun;
+}
+
+static std::shared_ptr<csaw::ASTType> Undescribe(const std::string& description)
+{ // inverse of Describe: name[outer][inner]..., empty for void
+	if (description.empty())
+		return nullptr;
+
+	auto bracket = description.find('[');
+	std::vector<size_t> extents;
+	for (auto i = bracket; i != std::string::npos; i = description.find('[', i + 1))
+		extents.push_back(std::stoull(description.substr(i + 1)));
+
+	auto type = csaw::ASTType::Get(description.substr(0, bracket));
+	for (auto extent = extents.rbegin(); extent != extents.rend(); extent++)
+		type = csaw::ASTType::Get(type, *extent);
+	return type;
+}
+
+void csaw::GenIR(const std::shared_ptr<Environment>& env, const Stmt* stmt)
 {
-	if (auto s = std::dynamic_pointer_cast<AliasStmt>(stmt))
-		return GenIR(env, s);
-	if (auto s = std::dynamic_pointer_cast<EnclosedStmt>(stmt))
-		return GenIR(env, s);
-	if (auto s = std::dynamic_pointer_cast<ForStmt>(stmt))
-		return GenIR(env, s);
-	if (auto s = std::dynamic_pointer_cast<FunStmt>(stmt))
-		return GenIR(env, s);
-	if (auto s = std::dynamic_pointer_cast<IfStmt>(stmt))
-		return GenIR(env, s);
-	if (auto s = std::dynamic_pointer_cast<IncStmt>(stmt))
-		return GenIR(env, s);
-	if (auto s = std::dynamic_pointer_cast<RetStmt>(stmt))
-		return GenIR(env, s);
-	if (auto s = std::dynamic_pointer_cast<ThingStmt>(stmt))
-		return GenIR(env, s);
-	if (auto s = std::dynamic_pointer_cast<VarStmt>(stmt))
-		return GenIR(env, s);
-	if (auto s = std::dynamic_pointer_cast<WhileStmt>(stmt))
-		return GenIR(env, s);
-
-	if (auto e = std::dynamic_pointer_cast<Expr>(stmt))
+	if (!stmt) // empty statement
+		return;
+
+	switch (stmt->Kind)
 	{
-		GenIR(env, e);
+	case STMT_ALIAS: return GenIR(env, static_cast<const AliasStmt*>(stmt));
+	case STMT_ENCLOSED: return GenIR(env, static_cast<const EnclosedStmt*>(stmt));
+	case STMT_FOR: return GenIR(env, static_cast<const ForStmt*>(stmt));
+	case STMT_FUN: return GenIR(env, static_cast<const FunStmt*>(stmt));
+	case STMT_IF: return GenIR(env, static_cast<const IfStmt*>(stmt));
+	case STMT_INC: return GenIR(env, static_cast<const IncStmt*>(stmt));
+	case STMT_REGION: return GenIR(env, static_cast<const RegionStmt*>(stmt));
+	case STMT_RET: return GenIR(env, static_cast<const RetStmt*>(stmt));
+	case STMT_THING: return GenIR(env, static_cast<const ThingStmt*>(stmt));
+	case STMT_VAR: return GenIR(env, static_cast<const VarStmt*>(stmt));
+	case STMT_WHILE: return GenIR(env, static_cast<const WhileStmt*>(stmt));
+	default: break;
+	}
+
+	if (stmt->IsExpr())
+	{
+		GenIR(env, static_cast<const Expr*>(stmt));
 		return;
 	}
 
 	throw "TODO";
 }
 
-void csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<AliasStmt>& stmt)
+void csaw::Declare(const std::shared_ptr<Environment>& env, const decl_t& decl)
+{ // replay one declaration of a precompiled interface
+	auto& fields = decl.fields;
+
+	switch (decl.kind)
+	{
+	case DECL_INC:
+	{
+		IncStmt stmt(fields[0]); // canonical, so independent of the including file
+		return GenIR(env, &stmt);
+	}
+	case DECL_THING:
+	{
+		std::vector<ASTParameter> parameters;
+		for (size_t i = 2; i + 1 < fields.size(); i += 2)
+			parameters.emplace_back(fields[i], Undescribe(fields[i + 1]));
+		ThingStmt stmt(fields[0], "", parameters, fields[1] == "value");
+		return GenIR(env, &stmt);
+	}
+	case DECL_ALIAS:
+	{
+		AliasStmt stmt(fields[0], Undescribe(fields[1]));
+		return GenIR(env, &stmt);
+	}
+	case DECL_VAR:
+	{
+		auto type = GenIR(Undescribe(fields[1]));
+		auto global = new llvm::GlobalVariable(Environment::Module(), type.type, false, llvm::GlobalValue::ExternalLinkage, nullptr, fields[0]);
+		env->CreateVariable(fields[0], value_t(global, type), true);
+		return;
+	}
+	case DECL_FUN:
+	{
+		auto memberof = fields[0].empty() ? type_t() : GenIR(Undescribe(fields[0]));
+		auto ret = GenIR(Undescribe(fields[2]));
+		auto isconstructor = fields[5] == "$";
+
+		std::vector<llvm::Type*> types;
+		std::vector<type_t> argtypes;
+		if (isconstructor)
+			types.push_back(ret.type);
+		for (size_t i = 6; i < fields.size(); i++)
+		{
+			argtypes.push_back(GenIR(Undescribe(fields[i])));
+			types.push_back(i == 6 && !fields[0].empty() ? Receiver(memberof) : argtypes.back().type);
+		}
+
+		if (Environment::GetFunction(memberof, fields[1], argtypes))
+			return;
+
+		fun_t fun;
+		auto funtype = llvm::FunctionType::get(ret.type, types, fields[4] == "?");
+		fun.fun = llvm::cast<llvm::Function>(Environment::Module().getOrInsertFunction(fields[3], funtype).getCallee());
+		fun.type = ret;
+		fun.argtypes = argtypes;
+		fun.isconstructor = isconstructor;
+		Environment::CreateFunction(memberof, fields[1], fun);
+		return;
+	}
+	}
+}
+
+void csaw::GenIR(const std::shared_ptr<Environment>& env, const AliasStmt* stmt)
 {
 	auto origin = GenIR(stmt->Origin);
 	return Environment::CreateAlias(stmt->Alias, origin);
 }
 
-void csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<EnclosedStmt>& stmt)
+void csaw::GenIR(const std::shared_ptr<Environment>& env, const EnclosedStmt* stmt)
 {
-	auto e = std::make_shared<Environment>(env);
+	env->PushScope();
 	for (auto& s : stmt->Body)
-		GenIR(e, s);
+		GenIR(env, s);
+	env->PopScope();
 }
 
-void csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<ForStmt>& stmt)
+void csaw::GenIR(const std::shared_ptr<Environment>& env, const ForStmt* stmt)
 {
 	auto fun = Environment::Builder().GetInsertBlock()->getParent();
 	auto bheader = llvm::BasicBlock::Create(Environment::Context(), "loop.header", fun);
 	auto bbody = llvm::BasicBlock::Create(Environment::Context(), "loop.body", fun);
 	auto bexit = llvm::BasicBlock::Create(Environment::Context(), "loop.exit", fun);
 
-	auto e = std::make_shared<Environment>(env);
+	env->PushScope();
 
-	GenIR(e, stmt->Begin);
+	GenIR(env, stmt->Begin);
 	Environment::Builder().CreateBr(bheader);
 
 	Environment::Builder().SetInsertPoint(bheader);
-	auto vcondition = GenIR(e, stmt->Condition);
-	auto condition = NumToBool(vcondition());
+	auto vcondition = GenIR(env, stmt->Condition);
+	auto condition = ToBool(vcondition());
 	Environment::Builder().CreateCondBr(condition, bbody, bexit);
 
 	Environment::Builder().SetInsertPoint(bbody);
-	GenIR(e, stmt->Body);
-	GenIR(e, stmt->Loop);
+	GenIR(env, stmt->Body);
+	GenIR(env, stmt->Loop);
 	Environment::Builder().CreateBr(bheader);
 
 	Environment::Builder().SetInsertPoint(bexit);
+
+	env->PopScope();
 }
 
-void csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<FunStmt>& stmt)
+void csaw::GenIR(const std::shared_ptr<Environment>& env, const FunStmt* stmt)
 {
-	std::vector<llvm::Type*> types;
-	std::vector<type_t> argtypes;
-
-	auto ret = GenIR(stmt->RetType);
-
-	type_t memberof;
+	auto fun = Signature(stmt);
+	auto ret = fun.type;
+	auto memberof = stmt->MemberOf ? GenIR(stmt->MemberOf) : type_t();
 	bool hasExtra = stmt->MemberOf || stmt->IsConstructor;
-	if (stmt->MemberOf)
-	{
-		memberof = GenIR(stmt->MemberOf);
-		types.push_back(memberof.type);
-		argtypes.push_back(memberof);
-	}
-	else if (stmt->IsConstructor)
-	{
-		types.push_back(ret.type);
-	}
-
-	for (auto& parameter : stmt->Parameters)
-	{
-		auto param = GenIR(parameter.Type);
-		types.push_back(param.type);
-		argtypes.push_back(param);
-	}
-
-	auto fun = Environment::GetFunction(memberof, stmt->Name, argtypes);
-	if (!fun)
-	{
-		auto funtype = llvm::FunctionType::get(ret.type, types, stmt->IsVarArg);
-		fun.fun = llvm::Function::Create(funtype, llvm::Function::ExternalLinkage, stmt->Name, Environment::Module());
-		fun.type = ret;
-		fun.argtypes = argtypes;
-		fun.isconstructor = stmt->IsConstructor;
-		Environment::CreateFunction(memberof, stmt->Name, fun);
-	}
 
 	if (!stmt->Body)
 		return;
 
+	if (fun()->getParent() != &Environment::Module()) // declared by another file
+		fun.fun = llvm::cast<llvm::Function>(Environment::Import(fun()));
 	if (!(fun()->empty()))
 		throw "cannot redefine function";
 
 	auto entry = llvm::BasicBlock::Create(Environment::Context(), "entry", fun());
 	Environment::Builder().SetInsertPoint(entry);
 
-	auto e = std::make_shared<Environment>(env);
+	llvm::IRBuilderBase::FastMathFlagGuard guard(Environment::Builder()); // restores strict FP for the code after this function
+	if (stmt->IsFast || Environment::FastMath())
+	{
+		Environment::Builder().setFastMathFlags(llvm::FastMathFlags::getFast());
+		fun()->addFnAttr("unsafe-fp-math", "true");
+		fun()->addFnAttr("no-infs-fp-math", "true");
+		fun()->addFnAttr("no-nans-fp-math", "true");
+		fun()->addFnAttr("no-signed-zeros-fp-math", "true");
+		fun()->addFnAttr("approx-func-fp-math", "true");
+	}
+
+	env->PushScope();
+	env->Result(ret);
+	auto outerVarArgs = env->SetVarArgs(nullptr); // the environment is shared, so '?' must not reach the valist of another function
 
 	int i = hasExtra ? -1 : 0;
 	for (auto& arg : fun()->args())
@@ -129,11 +247,14 @@ void csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<
 		auto& name = i < 0 ? "my" : stmt->Parameters[i].Name;
 		arg.setName(name);
 		auto type = i < 0 ? (stmt->IsConstructor ? ret : memberof) : GenIR(stmt->Parameters[i].Type);
-		e->CreateVariable(name, value_t(&arg, type));
+		if (i < 0 && !stmt->IsConstructor && IsValueThing(type))
+			env->CreateVariable(name, value_t(&arg, type), true); // already the caller's storage
+		else
+			env->CreateVariable(name, value_t(&arg, type));
 		i++;
 	}
 
-	GenIR(e, stmt->Body);
+	GenIR(env, stmt->Body);
 
 	for (auto& bb : *fun())
 	{
@@ -151,25 +272,27 @@ void csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<
 		if (stmt->IsConstructor)
 		{
 			Environment::Builder().SetInsertPoint(&bb);
-			Environment::Builder().CreateRet(e->GetVariable("my").value);
+			Environment::Builder().CreateRet(env->GetVariable("my").value);
 			continue;
 		}
 
 		throw "missing non-void terminator";
 	}
 
+	env->PopScope();
+	env->SetVarArgs(outerVarArgs);
+	Environment::HoistObjects(*fun());
+
 	if (llvm::verifyFunction(*fun(), &llvm::errs()))
 	{
 		fun()->print(llvm::errs());
 		throw "failed to verify function";
 	}
 
-	Environment::Optimize(fun());
-
-	Environment::Builder().SetInsertPoint(&Environment::Module().getFunction("__global__")->back()); // insert global stuff into the global init function
+	Environment::Builder().SetInsertPoint(&Environment::GlobalFunction()->back()); // insert global stuff into the global init function
 }
 
-void csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<IfStmt>& stmt)
+void csaw::GenIR(const std::shared_ptr<Environment>& env, const IfStmt* stmt)
 {
 	auto fun = Environment::Builder().GetInsertBlock()->getParent();
 	auto bthen = llvm::BasicBlock::Create(Environment::Context(), "if.then", fun);
@@ -177,7 +300,7 @@ void csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<
 	auto bexit = llvm::BasicBlock::Create(Environment::Context(), "if.exit");
 
 	auto vcondition = GenIR(env, stmt->Condition);
-	vcondition.value = NumToBool(vcondition());
+	vcondition.value = ToBool(vcondition());
 	Environment::Builder().CreateCondBr(vcondition(), bthen, belse);
 
 	Environment::Builder().SetInsertPoint(bthen);
@@ -196,30 +319,59 @@ void csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<
 	Environment::Builder().SetInsertPoint(bexit);
 }
 
-void csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<IncStmt>& stmt)
+void csaw::GenIR(const std::shared_ptr<Environment>& env, const IncStmt* stmt)
 {
 	if (!env->IsTopLevel())
 		throw "environment must be top level = no parent";
 
-	auto path = env->Path().parent_path() / stmt->Path;
+	auto path = std::filesystem::weakly_canonical(env->Path().parent_path() / stmt->Path);
+	if (!Environment::Include(path)) // generated once, its declarations stay visible to every later file
+		return;
 	if (!ParseInc(env, path))
 		throw "failed to parse included file";
 }
 
-void csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<RetStmt>& stmt)
+static void EndRegion(llvm::Value* region)
 {
+	auto end = csaw::Environment::Module().getOrInsertFunction("csaw_region_end", csaw::Environment::Builder().getVoidTy(), csaw::Environment::Builder().getInt64Ty());
+	csaw::Environment::Builder().CreateCall(end, { region });
+}
+
+void csaw::GenIR(const std::shared_ptr<Environment>& env, const RegionStmt* stmt)
+{
+	auto begin = Environment::Module().getOrInsertFunction("csaw_region_begin", Environment::Builder().getInt64Ty());
+	auto region = Environment::Builder().CreateCall(begin);
+
+	env->PushRegion(region);
+	GenIR(env, stmt->Body);
+	env->PopRegion();
+
+	if (!Environment::Builder().GetInsertBlock()->getTerminator())
+		EndRegion(region);
+}
+
+void csaw::GenIR(const std::shared_ptr<Environment>& env, const RetStmt* stmt)
+{
+	value_t value;
+	if (stmt->Value)
+		value = Cast(GenIR(env, stmt->Value), env->Result());
+
+	// leaving the function leaves every region it opened, the runtime closes the inner ones with the outermost
+	if (auto region = env->OuterRegion())
+		EndRegion(region);
+
 	if (!stmt->Value)
 		Environment::Builder().CreateRetVoid();
 	else
-		Environment::Builder().CreateRet(GenIR(env, stmt->Value).value);
+		Environment::Builder().CreateRet(value());
 }
 
-void csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<ThingStmt>& stmt)
+void csaw::GenIR(const std::shared_ptr<Environment>& env, const ThingStmt* stmt)
 {
 	if (stmt->Fields.empty())
 	{
 		auto strtype = llvm::StructType::create(Environment::Context(), stmt->Name);
-		Environment::CreateType(stmt->Name, strtype, {});
+		Environment::CreateType(stmt->Name, strtype, {}, stmt->IsValue);
 		return;
 	}
 
@@ -244,31 +396,42 @@ void csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<
 	}
 
 	strtype->setBody(elements);
-	Environment::CreateType(stmt->Name, strtype, fields);
+	Environment::CreateType(stmt->Name, strtype, fields, stmt->IsValue);
 }
 
-void csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<VarStmt>& stmt)
+void csaw::GenIR(const std::shared_ptr<Environment>& env, const VarStmt* stmt)
 {
 	auto type = GenIR(stmt->Type);
 
 	if (env->IsTopLevel())
 	{
-		llvm::Constant* initializer = nullptr;
+		llvm::Value* init = nullptr;
 		if (stmt->Value)
-			initializer = llvm::dyn_cast<llvm::Constant>(GenIR(env, stmt->Value)());
-		auto value = value_t(new llvm::GlobalVariable(Environment::Module(), type.type, false, llvm::GlobalValue::ExternalLinkage, initializer, stmt->Name), type);
-		env->CreateVariable(stmt->Name, value, true);
+			init = Cast(GenIR(env, stmt->Value), type)();
+		auto initializer = llvm::dyn_cast_or_null<llvm::Constant>(init);
+		if (init && !initializer) // computed by the global initializer, the variable itself must still be a definition
+			initializer = llvm::Constant::getNullValue(type.type);
+
+		auto global = new llvm::GlobalVariable(Environment::Module(), type.type, false, llvm::GlobalValue::ExternalLinkage, initializer, stmt->Name);
+		if (init && init != initializer)
+			Environment::Builder().CreateStore(init, global);
+		if (Environment::GC() && !IsPrimitive(type)) // the collector does not know where globals live
+		{
+			auto root = Environment::Module().getOrInsertFunction("csaw_gc_root", Environment::Builder().getVoidTy(), Environment::Builder().getPtrTy(), Environment::Builder().getInt64Ty());
+			Environment::Builder().CreateCall(root, { global, llvm::ConstantExpr::getSizeOf(type.type) });
+		}
+		env->CreateVariable(stmt->Name, value_t(global, type), true);
 		return;
 	}
 
 	value_t value;
-	if (stmt->Value) value = GenIR(env, stmt->Value);
+	if (stmt->Value) value = Cast(GenIR(env, stmt->Value), type);
 	else value = Environment::GetNull(type);
 
 	env->CreateVariable(stmt->Name, value);
 }
 
-void csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<WhileStmt>& stmt)
+void csaw::GenIR(const std::shared_ptr<Environment>& env, const WhileStmt* stmt)
 {
 	auto fun = Environment::Builder().GetInsertBlock()->getParent();
 	auto bheader = llvm::BasicBlock::Create(Environment::Context(), "loop.header", fun);
@@ -279,7 +442,7 @@ void csaw::GenIR(const std::shared_ptr<Environment>& env, const std::shared_ptr<
 
 	Environment::Builder().SetInsertPoint(bheader);
 	auto vcondition = GenIR(env, stmt->Condition);
-	auto condition = NumToBool(vcondition());
+	auto condition = ToBool(vcondition());
 	Environment::Builder().CreateCondBr(condition, bbody, bexit);
 
 	Environment::Builder().SetInsertPoint(bbody);
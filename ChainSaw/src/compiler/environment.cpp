@@ -1,95 +1,351 @@
 #include "compiler.h"
+#include "objectcache.h"
+#include "tiered.h"
 
 #include <csawstd.h>
 #include <format>
+#include <optional>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ADT/StringExtras.h>
 #include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/IntrinsicInst.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Verifier.h>
+#include <llvm/Linker/Linker.h>
 #include <llvm/MC/TargetRegistry.h>
 #include <llvm/Passes/PassBuilder.h>
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/ThreadPool.h>
 #include <llvm/TargetParser/Host.h>
-#include <llvm/Transforms/InstCombine/InstCombine.h>
-#include <llvm/Transforms/Scalar/DCE.h>
-#include <llvm/Transforms/Scalar/GVN.h>
-#include <llvm/Transforms/Scalar/LoopUnrollPass.h>
-#include <llvm/Transforms/Scalar/Reassociate.h>
-#include <llvm/Transforms/Scalar/SimplifyCFG.h>
-#include <llvm/Transforms/Utils/Mem2Reg.h>
-
-std::map<csaw::type_t, std::map<std::string, std::vector<csaw::fun_t>>> csaw::Environment::m_Functions;
+#include <llvm/TargetParser/SubtargetFeature.h>
+#include <llvm/Transforms/IPO/AlwaysInliner.h>
+#include <llvm/Transforms/Utils/SplitModule.h>
+
+std::unordered_map<csaw::type_t, std::unordered_map<unsigned, std::vector<csaw::fun_t>>, csaw::type_hash> csaw::Environment::m_Functions;
+std::unordered_map<csaw::call_t, const csaw::fun_t*, csaw::call_hash> csaw::Environment::m_Calls;
 std::map<std::string, csaw::thing_t> csaw::Environment::m_Types;
-std::map<std::string, csaw::type_t> csaw::Environment::m_Alias;
+std::unordered_map<llvm::StructType*, const csaw::thing_t*> csaw::Environment::m_Structs;
+std::unordered_map<unsigned, csaw::type_t> csaw::Environment::m_Alias;
 
 std::unique_ptr<llvm::LLVMContext> csaw::Environment::m_Context;
 std::unique_ptr<llvm::IRBuilder<>> csaw::Environment::m_Builder;
 std::unique_ptr<llvm::Module> csaw::Environment::m_Module;
+llvm::Module* csaw::Environment::m_Current = nullptr;
+llvm::Function* csaw::Environment::m_Global = nullptr;
+
+std::set<std::filesystem::path> csaw::Environment::m_Included;
+std::vector<csaw::unit_t> csaw::Environment::m_Open;
+std::vector<std::unique_ptr<llvm::Module>> csaw::Environment::m_Units;
+llvm::SHA1 csaw::Environment::m_Interface;
+
+unsigned csaw::Environment::m_OptLevel = 2;
+std::string csaw::Environment::m_CPU;
+bool csaw::Environment::m_FastMath = false;
+std::filesystem::path csaw::Environment::m_CacheDir;
+unsigned csaw::Environment::m_TierThreshold = 1000;
+unsigned csaw::Environment::m_Jobs = 1;
+bool csaw::Environment::m_GC = false;
+std::string csaw::Environment::m_Features;
+llvm::TargetOptions csaw::Environment::m_TargetOptions = []
+{
+	llvm::TargetOptions options;
+	options.AllowFPOpFusion = llvm::FPOpFusion::Fast; // contract a * b + c into fma where the target has it
+	return options;
+}();
+
+static bool IsHostCPU(const std::string& cpu)
+{
+	return cpu.empty() || cpu == "native";
+}
+
+static std::string HostFeatures()
+{
+	llvm::SubtargetFeatures features;
+	llvm::StringMap<bool> host;
+	if (llvm::sys::getHostCPUFeatures(host))
+		for (auto& feature : host)
+			features.AddFeature(feature.first(), feature.second);
+	return features.getString();
+}
+
+static llvm::CodeGenOpt::Level CodeGenLevel(unsigned level)
+{
+	switch (level)
+	{
+	case 0: return llvm::CodeGenOpt::None;
+	case 1: return llvm::CodeGenOpt::Less;
+	case 2: return llvm::CodeGenOpt::Default;
+	default: return llvm::CodeGenOpt::Aggressive;
+	}
+}
+
+static llvm::AllocaInst* EntryAlloca(llvm::Type* type)
+{ // stack slots live in the entry block: allocated once per call wherever they are declared, and promotable by mem2reg
+	auto& entry = csaw::Environment::Builder().GetInsertBlock()->getParent()->getEntryBlock();
+	llvm::IRBuilder<> builder(&entry, entry.begin());
+	return builder.CreateAlloca(type);
+}
+
+static bool IsSingleStoreSlot(llvm::AllocaInst* slot)
+{ // a variable only assigned where it is declared always holds the value stored there, whichever iteration reads it
+	if (!slot->getAllocatedType()->isPointerTy())
+		return false;
+
+	unsigned stores = 0;
+	for (auto user : slot->users())
+	{
+		if (auto store = llvm::dyn_cast<llvm::StoreInst>(user); store && store->getPointerOperand() == slot)
+			stores++;
+		else if (!llvm::isa<llvm::LoadInst>(user))
+			return false;
+	}
+	return stores == 1;
+}
+
+static bool Escapes(llvm::Value* ptr, bool mayReturn, std::set<llvm::Value*>& seen, llvm::function_ref<llvm::Function*(llvm::Function*)> definition)
+{ // whether an object may still be referenced after its construction site is reached again, or after its frame is gone
+	if (!seen.insert(ptr).second) // already followed, or on a cycle that has to escape elsewhere to escape at all
+		return false;
+
+	for (auto user : ptr->users())
+	{
+		if (llvm::isa<llvm::LoadInst>(user) || llvm::isa<llvm::ICmpInst>(user) || llvm::isa<llvm::MemIntrinsic>(user))
+			continue;
+
+		if (auto store = llvm::dyn_cast<llvm::StoreInst>(user))
+		{
+			if (store->getValueOperand() != ptr)
+				continue;
+
+			auto slot = llvm::dyn_cast<llvm::AllocaInst>(store->getPointerOperand());
+			if (!slot || !IsSingleStoreSlot(slot))
+				return true;
+			for (auto load : slot->users())
+				if (llvm::isa<llvm::LoadInst>(load) && Escapes(load, mayReturn, seen, definition))
+					return true;
+			continue;
+		}
+
+		if (llvm::isa<llvm::GetElementPtrInst>(user) || llvm::isa<llvm::PHINode>(user) || llvm::isa<llvm::SelectInst>(user))
+		{
+			if (Escapes(user, mayReturn, seen, definition))
+				return true;
+			continue;
+		}
+
+		if (llvm::isa<llvm::ReturnInst>(user))
+		{
+			if (!mayReturn)
+				return true;
+			continue;
+		}
+
+		auto call = llvm::dyn_cast<llvm::CallInst>(user);
+		auto callee = call && call->getCalledFunction() ? definition(call->getCalledFunction()) : nullptr;
+		if (!callee) // runtime functions, and functions without a body yet
+			return true;
+
+		for (unsigned i = 0; i < call->arg_size(); i++)
+			if (call->getArgOperand(i) == ptr && (i >= callee->arg_size() || Escapes(callee->getArg(i), true, seen, definition)))
+				return true;
+
+		// the callee may hand the object back, a constructor always does
+		if (Escapes(call, mayReturn, seen, definition))
+			return true;
+	}
+
+	return false;
+}
+
+static std::unique_ptr<llvm::Module> LoadUnit(const std::filesystem::path& entry)
+{ // nullptr if the entry is missing or unreadable, the file is then generated again
+	auto buffer = llvm::MemoryBuffer::getFile(entry.string(), false, false);
+	if (!buffer)
+		return nullptr;
+
+	auto module = llvm::parseBitcodeFile((*buffer)->getMemBufferRef(), csaw::Environment::Context());
+	if (!module)
+	{
+		llvm::consumeError(module.takeError());
+		return nullptr;
+	}
+	return std::move(*module);
+}
+
+static std::string Hash(llvm::StringRef data)
+{
+	llvm::SHA1 sha;
+	sha.update(data);
+	return llvm::toHex(sha.final(), true);
+}
+
+static bool Unchanged(const csaw::interface_t& iface)
+{ // the files a cached file includes are only hashed, not parsed
+	for (auto& [path, hash] : iface.deps)
+	{
+		auto buffer = llvm::MemoryBuffer::getFile(path, false, false);
+		if (!buffer || Hash((*buffer)->getBuffer()) != hash)
+			return false;
+	}
+	return true;
+}
+
+static void StoreUnit(const llvm::Module& module, const std::filesystem::path& entry)
+{
+	std::error_code ec;
+	std::filesystem::create_directories(entry.parent_path(), ec);
+	if (ec)
+	{
+		llvm::errs() << "Failed to create cache directory '" << entry.parent_path().string() << "': " << ec.message() << "\r\n";
+		return;
+	}
+
+	csaw::StoreEntry(entry, [&module](llvm::raw_ostream& dst) { llvm::WriteBitcodeToFile(module, dst); });
+}
+
+static std::vector<llvm::SmallVector<char, 0>> Partition(llvm::Module& module, unsigned count)
+{ // split the module and serialize each part, so every thread can load its own into a private context
+	// splitting externalizes local symbols: the internal bodies of the runtime intrinsics must be inlined and gone
+	// by now (OPT_SIMPLIFY, at any level), else they become definitions clashing with the runtime's own symbols
+	std::vector<llvm::SmallVector<char, 0>> partitions;
+	llvm::SplitModule(module, count, [&partitions](std::unique_ptr<llvm::Module> part)
+	{
+		llvm::raw_svector_ostream out(partitions.emplace_back());
+		llvm::WriteBitcodeToFile(*part, out);
+	});
+	return partitions;
+}
+
+static llvm::Expected<llvm::orc::ThreadSafeModule> LoadPartition(const llvm::SmallVector<char, 0>& partition, const std::string& name)
+{
+	auto context = std::make_unique<llvm::LLVMContext>();
+	auto module = llvm::parseBitcodeFile(llvm::MemoryBufferRef(llvm::StringRef(partition.data(), partition.size()), name), *context);
+	if (!module)
+		return module.takeError();
+	return llvm::orc::ThreadSafeModule(std::move(*module), std::move(context));
+}
+
+static bool EmitObject(llvm::Module& module, llvm::TargetMachine* machine, const std::string& filename)
+{
+	std::error_code ec;
+	llvm::raw_fd_ostream dst(filename, ec, llvm::sys::fs::OF_None);
+
+	if (ec)
+	{
+		llvm::errs() << "Failed to open file '" << filename << "': " << ec.message() << "\r\n";
+		return false;
+	}
+
+	llvm::legacy::PassManager pm;
+	auto type = llvm::CodeGenFileType::ObjectFile;
+
+	if (machine->addPassesToEmitFile(pm, dst, nullptr, type))
+	{
+		llvm::errs() << "Failed to emit file of type '" << (type == llvm::CodeGenFileType::AssemblyFile ? "AssemblyFile" : type == llvm::CodeGenFileType::ObjectFile ? "ObjectFile" : "Null") << "'\r\n";
+		return false;
+	}
 
-std::unique_ptr<llvm::FunctionPassManager> csaw::Environment::m_FPM;
-std::unique_ptr<llvm::LoopAnalysisManager> csaw::Environment::m_LAM;
-std::unique_ptr<llvm::FunctionAnalysisManager> csaw::Environment::m_FAM;
-std::unique_ptr<llvm::CGSCCAnalysisManager> csaw::Environment::m_CGAM;
-std::unique_ptr<llvm::ModuleAnalysisManager> csaw::Environment::m_MAM;
-std::unique_ptr<llvm::PassInstrumentationCallbacks> csaw::Environment::m_PIC;
-std::unique_ptr<llvm::StandardInstrumentations> csaw::Environment::m_SI;
+	pm.run(module);
+	dst.flush();
+	return true;
+}
+
+void csaw::Environment::PushScope()
+{
+	m_Scopes.push_back(m_Symbols.size());
+}
+
+void csaw::Environment::PopScope()
+{
+	auto begin = m_Scopes.back();
+	m_Scopes.pop_back();
+
+	while (m_Symbols.size() > begin)
+	{
+		auto& symbol = m_Symbols.back();
+		m_Innermost[symbol.name] = symbol.shadowed;
+		m_Symbols.pop_back();
+	}
+}
 
 csaw::value_t csaw::Environment::CreateVariable(const std::string& name, const value_t& value, bool isGlobal)
 {
-	if (m_Variables.contains(name))
+	auto id = Intern(name);
+	if (id >= m_Innermost.size())
+		m_Innermost.resize(id + 1, -1);
+
+	auto innermost = m_Innermost[id];
+	if (innermost >= 0 && (size_t)innermost >= (m_Scopes.empty() ? 0 : m_Scopes.back()))
 	{
 		llvm::errs() << "Cannot redefine variable '" << name << "'\r\n";
 		throw;
 	}
 
+	m_Innermost[id] = (int)m_Symbols.size();
+
 	if (isGlobal)
-		return m_Variables[name] = value;
+	{
+		if (IsTopLevel()) // else it is bound to storage it does not own, like "my" of a value thing
+			Export({ DECL_VAR, { name, Describe(value.ptrType) } });
+		m_Symbols.push_back({ id, value, innermost });
+		return value;
+	}
 
-	auto ptr = Builder().CreateAlloca(value.ptrType.type);
+	auto ptr = EntryAlloca(value.ptrType.type);
 	Builder().CreateStore(value(), ptr);
 
-	m_Variables[name] = value_t(ptr, value.ptrType);
+	m_Symbols.push_back({ id, value_t(ptr, value.ptrType), innermost });
 
 	return value;
 }
 
 csaw::value_t csaw::Environment::SetVariable(const std::string& name, const value_t& value)
 {
-	auto& var = GetVar(name);
-	auto ptr = var();
+	auto var = GetVar(name);
+	auto ptr = Import(var());
 
-	Builder().CreateStore(value(), ptr);
+	auto stored = Cast(value, var.ptrType);
+	Builder().CreateStore(stored(), ptr);
 
-	return value;
+	return stored;
 }
 
 csaw::value_t csaw::Environment::GetVariable(const std::string& name)
 {
-	auto& var = GetVar(name);
-	auto ptr = var();
+	auto var = GetVar(name);
+	auto ptr = Import(var());
 
 	return value_t(Builder().CreateLoad(var.ptrType.type, ptr, name), var.ptrType);
 }
 
+csaw::value_t csaw::Environment::GetReference(const std::string& name)
+{ // the variable's storage instead of its value
+	auto var = GetVar(name);
+	return value_t(Import(var()), var.ptrType);
+}
+
 llvm::Value* csaw::Environment::SetVarArgs(llvm::Value* valist)
-{
-	return m_VarArgs = valist;
+{ // the previous valist, to restore once the function that set this one is done
+	auto previous = m_VarArgs;
+	m_VarArgs = valist;
+	return previous;
 }
 
 llvm::Value* csaw::Environment::GetVarArgs()
 {
 	if (m_VarArgs)
 		return m_VarArgs;
-	if (m_Parent)
-		return m_Parent->GetVarArgs();
+	llvm::errs() << "Cannot use '?' outside of a function with varargs\r\n";
 	throw;
 }
 
-csaw::value_t& csaw::Environment::GetVar(const std::string& name)
+csaw::value_t csaw::Environment::GetVar(const std::string& name)
 {
-	if (m_Variables.contains(name))
-		return m_Variables[name];
-	if (m_Parent)
-		return m_Parent->GetVar(name);
+	auto id = Intern(name);
+	if (id < m_Innermost.size() && m_Innermost[id] >= 0)
+		return m_Symbols[m_Innermost[id]].value;
 	llvm::errs() << "Undefined variable '" << name << "'\r\n";
 	throw;
 }
@@ -101,67 +357,320 @@ void csaw::Environment::InitEnvironment()
 
 	m_Builder = std::make_unique<llvm::IRBuilder<>>(*m_Context);
 
-	m_FPM = std::make_unique<llvm::FunctionPassManager>();
-	m_LAM = std::make_unique<llvm::LoopAnalysisManager>();
-	m_FAM = std::make_unique<llvm::FunctionAnalysisManager>();
-	m_CGAM = std::make_unique<llvm::CGSCCAnalysisManager>();
-	m_MAM = std::make_unique<llvm::ModuleAnalysisManager>();
-	m_PIC = std::make_unique<llvm::PassInstrumentationCallbacks>();
-	m_SI = std::make_unique<llvm::StandardInstrumentations>(*m_Context, true);
-
-	m_SI->registerCallbacks(*m_PIC, m_MAM.get());
-
-	m_FPM->addPass(llvm::PromotePass());
-	m_FPM->addPass(llvm::InstCombinePass());
-	m_FPM->addPass(llvm::ReassociatePass());
-	m_FPM->addPass(llvm::GVNPass());
-	m_FPM->addPass(llvm::SimplifyCFGPass());
-	m_FPM->addPass(llvm::DCEPass());
-	m_FPM->addPass(llvm::LoopSimplifyPass());
-	m_FPM->addPass(llvm::LoopUnrollPass());
-
-	llvm::PassBuilder passes;
-	passes.registerModuleAnalyses(*m_MAM);
-	passes.registerFunctionAnalyses(*m_FAM);
-	passes.crossRegisterProxies(*m_LAM, *m_FAM, *m_CGAM, *m_MAM);
-
 	auto triple = llvm::sys::getDefaultTargetTriple();
 	m_Module->setTargetTriple(triple);
 
-	CreateGlobalFunction();
+	m_Current = m_Module.get();
+	CreateGlobalFunction("__global__");
+}
+
+bool csaw::Environment::Include(const std::filesystem::path& path)
+{ // false if the file was generated before
+	return m_Included.insert(path).second;
+}
+
+const csaw::interface_t* csaw::Environment::BeginUnit(const std::filesystem::path& path, const std::string& source)
+{ // the interface to replay if the file's module came from the cache, nullptr if the file has to be generated
+	unit_t unit{ "", path.string(), Hash(source), m_Current, m_Global, Builder().saveIP() };
+
+	// the code of a file depends on its source and on everything declared before it
+	llvm::SHA1 sha;
+	sha.update(unit.hash);
+	sha.update(m_Interface.result());
+	sha.update(Module().getTargetTriple() + (m_FastMath ? " fast" : "") + (m_GC ? " gc" : ""));
+	unit.key = llvm::toHex(sha.final(), true);
+
+	if (!m_Open.empty() && !m_Open.back().cached)
+		m_Open.back().iface->decls.push_back({ DECL_INC, { unit.path } });
+
+	if (!m_CacheDir.empty())
+	{
+		auto iface = LoadInterface(m_CacheDir / (unit.key + ".csi"));
+		auto module = iface && Unchanged(*iface) ? LoadUnit(m_CacheDir / (unit.key + ".bc")) : nullptr;
+		if (module)
+		{
+			unit.cached = true;
+			unit.iface = std::move(iface);
+			m_Open.push_back(std::move(unit));
+			m_Units.push_back(std::move(module));
+			return m_Open.back().iface.get();
+		}
+	}
+
+	auto module = std::make_unique<llvm::Module>(unit.key, Context());
+	module->setTargetTriple(Module().getTargetTriple());
+	m_Current = module.get();
+	m_Units.push_back(std::move(module));
+
+	unit.iface = std::make_shared<interface_t>();
+	m_Open.push_back(std::move(unit));
+
+	CreateGlobalFunction("__global__." + m_Open.back().key);
+	return nullptr;
+}
+
+void csaw::Environment::EndUnit()
+{
+	auto unit = std::move(m_Open.back());
+	m_Open.pop_back();
+
+	if (!unit.cached)
+	{
+		FinishGlobalFunction();
+		if (!m_CacheDir.empty())
+		{
+			StoreUnit(Module(), m_CacheDir / (unit.key + ".bc"));
+			StoreInterface(*unit.iface, m_CacheDir / (unit.key + ".csi"));
+		}
+	}
+
+	m_Current = unit.parent;
+	m_Global = unit.global;
+	Builder().restoreIP(unit.ip);
+
+	// a cached includer already calls the initializer and lists the file among its dependencies
+	if (!m_Open.empty() && m_Open.back().cached)
+		return;
+
+	Builder().CreateCall(Module().getOrInsertFunction("__global__." + unit.key, Builder().getVoidTy()));
+
+	if (!m_Open.empty())
+	{
+		auto& deps = m_Open.back().iface->deps;
+		deps.emplace_back(unit.path, unit.hash);
+		deps.insert(deps.end(), unit.iface->deps.begin(), unit.iface->deps.end());
+	}
+}
+
+void csaw::Environment::Link()
+{ // merge the modules of all included files into the main one
+	for (auto& unit : m_Units)
+	{
+		auto key = unit->getModuleIdentifier();
+		if (llvm::Linker::linkModules(*m_Module, std::move(unit)))
+		{
+			llvm::errs() << "Failed to link module '" << key << "'\r\n";
+			throw;
+		}
+	}
+	m_Units.clear();
+
+	DefineIntrinsics();
+}
+
+void csaw::Environment::DefineIntrinsics()
+{ // give small runtime calls an inline body, so loops over strings and chars fold instead of calling into csawstd
+	llvm::IRBuilderBase::InsertPointGuard guard(Builder());
+
+	auto define = [](const char* name) -> llvm::Function*
+	{
+		auto fun = Module().getFunction(name);
+		if (!fun || !fun->isDeclaration()) // unused, or defined by the program itself
+			return nullptr;
+		fun->setLinkage(llvm::GlobalValue::InternalLinkage);
+		fun->addFnAttr(llvm::Attribute::AlwaysInline);
+		Builder().SetInsertPoint(llvm::BasicBlock::Create(Context(), "entry", fun));
+		return fun;
+	};
+
+	if (auto fun = define("csaw_str_get"))
+	{
+		auto index = Builder().CreateFPToUI(fun->getArg(1), Builder().getInt64Ty());
+		auto ptr = Builder().CreateGEP(Builder().getInt8Ty(), fun->getArg(0), index);
+		Builder().CreateRet(Builder().CreateLoad(fun->getReturnType(), ptr));
+	}
+
+	if (auto fun = define("csaw_str_len"))
+	{ // the length sits in the 8 bytes in front of the chars, a null str has none
+		auto str = fun->getArg(0);
+		auto some = llvm::BasicBlock::Create(Context(), "some", fun);
+		auto none = llvm::BasicBlock::Create(Context(), "none", fun);
+		Builder().CreateCondBr(Builder().CreateIsNull(str), none, some);
+
+		Builder().SetInsertPoint(some);
+		auto header = Builder().CreateGEP(Builder().getInt8Ty(), str, llvm::ConstantInt::getSigned(Builder().getInt64Ty(), -8));
+		auto length = Builder().CreateAlignedLoad(Builder().getInt64Ty(), header, llvm::Align(8));
+		Builder().CreateRet(Builder().CreateUIToFP(length, fun->getReturnType()));
+
+		Builder().SetInsertPoint(none);
+		Builder().CreateRet(llvm::ConstantFP::get(fun->getReturnType(), 0.0));
+	}
+
+	// chr is unsigned, like Cast treats it
+	if (auto fun = define("csaw_chr_to_num"))
+		Builder().CreateRet(Builder().CreateUIToFP(fun->getArg(0), fun->getReturnType()));
+
+	if (auto fun = define("csaw_num_to_chr"))
+		Builder().CreateRet(Builder().CreateFPToUI(fun->getArg(0), fun->getReturnType()));
+}
+
+llvm::Value* csaw::Environment::Import(llvm::Value* value)
+{ // functions and globals of another file's module are referenced through a declaration in the current one
+	auto global = llvm::dyn_cast<llvm::GlobalValue>(value);
+	if (!global || global->getParent() == &Module())
+		return value;
+
+	if (auto fun = llvm::dyn_cast<llvm::Function>(global))
+		return Module().getOrInsertFunction(fun->getName(), fun->getFunctionType()).getCallee();
+	return Module().getOrInsertGlobal(global->getName(), global->getValueType());
+}
+
+void csaw::Environment::Optimize(llvm::Module& module, llvm::TargetMachine* machine, unsigned level, const OptStage stage)
+{ // run the default module pipeline, or one half of it, for the given level
+	if (!level && stage != OPT_SIMPLIFY)
+		return;
+
+	llvm::LoopAnalysisManager lam;
+	llvm::FunctionAnalysisManager fam;
+	llvm::CGSCCAnalysisManager cgam;
+	llvm::ModuleAnalysisManager mam;
+
+	llvm::PassBuilder passes(machine);
+	passes.registerModuleAnalyses(mam);
+	passes.registerCGSCCAnalyses(cgam);
+	passes.registerFunctionAnalyses(fam);
+	passes.registerLoopAnalyses(lam);
+	passes.crossRegisterProxies(lam, fam, cgam, mam);
+
+	static const llvm::OptimizationLevel levels[] = { llvm::OptimizationLevel::O0, llvm::OptimizationLevel::O1, llvm::OptimizationLevel::O2, llvm::OptimizationLevel::O3 };
+	auto olevel = levels[std::min(level, 3u)];
+	llvm::ModulePassManager mpm;
+	if (!level) // -O0 still inlines the runtime intrinsics before a module is partitioned, see Partition
+		mpm.addPass(llvm::AlwaysInlinerPass());
+	else
+		mpm = stage == OPT_SIMPLIFY ? passes.buildModuleSimplificationPipeline(olevel, llvm::ThinOrFullLTOPhase::None)
+			: stage == OPT_LATE ? passes.buildModuleOptimizationPipeline(olevel, llvm::ThinOrFullLTOPhase::None)
+			: passes.buildPerModuleDefaultPipeline(olevel);
+	mpm.run(module, mam);
+}
+
+void csaw::Environment::Target(const std::string& cpu, const std::string& features)
+{
+	m_CPU = cpu;
+	m_Features = features;
+}
+
+void csaw::Environment::FPContract(const std::string& mode)
+{
+	if (mode == "fast")
+		m_TargetOptions.AllowFPOpFusion = llvm::FPOpFusion::Fast;
+	else if (mode == "on")
+		m_TargetOptions.AllowFPOpFusion = llvm::FPOpFusion::Standard;
+	else if (mode == "off")
+		m_TargetOptions.AllowFPOpFusion = llvm::FPOpFusion::Strict;
+	else
+	{
+		llvm::errs() << "Undefined fp contraction mode '" << mode << "'\r\n";
+		throw;
+	}
+}
+
+void csaw::Environment::FastMath(bool enable)
+{
+	m_FastMath = enable;
+	m_TargetOptions.UnsafeFPMath = enable;
+	m_TargetOptions.NoInfsFPMath = enable;
+	m_TargetOptions.NoNaNsFPMath = enable;
+	m_TargetOptions.NoSignedZerosFPMath = enable;
+	m_TargetOptions.ApproxFuncFPMath = enable;
 }
 
 void csaw::Environment::CreateFunction(const type_t& memberof, const std::string& name, const fun_t& fun)
 {
-	m_Functions[memberof][name].push_back(fun);
+	decl_t decl{ DECL_FUN, { Describe(memberof), name, Describe(fun.type), fun.fun->getName().str(), fun.fun->isVarArg() ? "?" : "", fun.isconstructor ? "$" : "" } };
+	for (auto& argtype : fun.argtypes)
+		decl.fields.push_back(Describe(argtype));
+	Export(decl);
+
+	m_Functions[memberof][Intern(name)].push_back(fun);
+	m_Calls.clear(); // memoized entries may point into the grown overload list or be stale misses
 }
 
 csaw::fun_t csaw::Environment::GetFunction(const type_t& memberof, const std::string& name, const std::vector<type_t>& argtypes)
 {
-	auto& funs = m_Functions[memberof][name];
-	if (funs.empty())
-		return fun_t();
+	if (auto fun = FindFunction(memberof, name, argtypes))
+		return *fun;
+	return fun_t();
+}
+
+const csaw::fun_t* csaw::Environment::FindFunction(const type_t& memberof, const std::string& name, const std::vector<type_t>& argtypes)
+{
+	call_t call{ memberof, Intern(name), argtypes };
+
+	auto memo = m_Calls.find(call);
+	if (memo != m_Calls.end())
+		return memo->second;
+
+	const fun_t* result = nullptr;
+
+	auto receiver = m_Functions.find(memberof);
+	if (receiver != m_Functions.end())
+	{
+		auto funs = receiver->second.find(call.name);
+		if (funs != receiver->second.end())
+			for (auto& fun : funs->second)
+			{
+				if (fun.argtypes.size() > argtypes.size() || (fun.argtypes.size() < argtypes.size() && !fun.fun->isVarArg()))
+					continue;
+
+				size_t i = 0;
+				for (; i < fun.argtypes.size(); i++)
+					if (fun.argtypes[i] != argtypes[i])
+						break;
+
+				if (i == fun.argtypes.size())
+				{
+					result = &fun;
+					break;
+				}
+			}
+	}
+
+	return m_Calls[std::move(call)] = result;
+}
+
+const csaw::fun_t* csaw::Environment::FindConvertible(const type_t& memberof, const std::string& name, const std::vector<value_t>& args)
+{
+	// not memoized: whether a literal argument converts depends on its value
+	auto receiver = m_Functions.find(memberof);
+	if (receiver == m_Functions.end())
+		return nullptr;
+
+	auto funs = receiver->second.find(Intern(name));
+	if (funs == receiver->second.end())
+		return nullptr;
 
-	for (auto& fun : funs)
+	for (auto& fun : funs->second)
 	{
-		if (fun.argtypes.size() > argtypes.size() || (fun.argtypes.size() < argtypes.size() && !fun()->isVarArg()))
+		if (fun.argtypes.size() > args.size() || (fun.argtypes.size() < args.size() && !fun.fun->isVarArg()))
 			continue;
 
 		size_t i = 0;
 		for (; i < fun.argtypes.size(); i++)
-			if (fun.argtypes[i] != argtypes[i])
+			if (!Converts(args[i], fun.argtypes[i]))
 				break;
 
 		if (i == fun.argtypes.size())
-			return fun;
+			return &fun;
 	}
 
-	return fun_t();
+	return nullptr;
 }
 
-void csaw::Environment::CreateType(const std::string& name, llvm::StructType* type, const std::vector<std::pair<std::string, type_t>>& fields)
+void csaw::Environment::CreateType(const std::string& name, llvm::StructType* type, const std::vector<std::pair<std::string, type_t>>& fields, bool isValue)
 {
-	m_Types[name] = { type, fields };
+	decl_t decl{ DECL_THING, { name, isValue ? "value" : "" } };
+	for (auto& field : fields)
+	{
+		decl.fields.push_back(field.first);
+		decl.fields.push_back(Describe(field.second));
+	}
+	Export(decl);
+
+	auto& thing = m_Types[name] = { type, fields, {}, isValue };
+	for (int i = 0; i < (int)fields.size(); i++)
+		thing.index[Intern(fields[i].first)] = i;
+	m_Structs[type] = &thing;
 }
 
 const csaw::thing_t* csaw::Environment::GetType(const std::string& name)
@@ -173,34 +682,31 @@ const csaw::thing_t* csaw::Environment::GetType(const std::string& name)
 
 const csaw::thing_t* csaw::Environment::GetType(llvm::StructType* strtype)
 {
-	for (auto& type : m_Types)
-		if (type.second.type == strtype)
-			return &type.second;
-	return nullptr;
+	auto entry = m_Structs.find(strtype);
+	if (entry == m_Structs.end())
+		return nullptr;
+	return entry->second;
 }
 
 void csaw::Environment::CreateAlias(const std::string& alias, const type_t& origin)
 {
-	m_Alias[alias] = origin;
+	Export({ DECL_ALIAS, { alias, Describe(origin) } });
+	m_Alias[Intern(alias)] = origin; // origin is already resolved, so chains collapse here
 }
 
-bool csaw::Environment::HasAlias(const std::string& alias)
+const csaw::type_t* csaw::Environment::GetAlias(const std::string& alias)
 {
-	return m_Alias.contains(alias);
-}
-
-const csaw::type_t& csaw::Environment::GetAlias(const std::string& alias)
-{
-	if (HasAlias(alias))
-		return GetAlias(m_Alias[alias].name);
-	return GenIR(alias);
+	auto entry = m_Alias.find(Intern(alias));
+	if (entry == m_Alias.end())
+		return nullptr;
+	return &entry->second;
 }
 
 csaw::value_t csaw::Environment::GetNull(const type_t& type)
 {
 	if (type.type->isPointerTy())
 	{
-		auto ptr = Builder().CreateAlloca(type.element);
+		auto ptr = Builder().CreateAlloca(type.element); // a new object each time it is reached, see HoistObjects
 		Builder().CreateStore(llvm::Constant::getNullValue(type.element), ptr);
 		return value_t(ptr, type);
 	}
@@ -208,17 +714,54 @@ csaw::value_t csaw::Environment::GetNull(const type_t& type)
 	return value_t(llvm::Constant::getNullValue(type.type), type);
 }
 
+void csaw::Environment::HoistObjects(llvm::Function& fun)
+{ // objects that never outlive one pass over their construction site move to the entry block, so a loop reuses their slot
+	auto definition = [](llvm::Function* callee) -> llvm::Function*
+	{ // the body of a function declared in the module being generated and defined in another one
+		if (!callee->isDeclaration())
+			return callee;
+		if (auto fun = m_Module->getFunction(callee->getName()); fun && !fun->isDeclaration())
+			return fun;
+		for (auto& unit : m_Units)
+			if (auto fun = unit->getFunction(callee->getName()); fun && !fun->isDeclaration())
+				return fun;
+		return nullptr;
+	};
+
+	auto& entry = fun.getEntryBlock();
+	std::vector<llvm::AllocaInst*> objects;
+	for (auto& bb : fun)
+		if (&bb != &entry)
+			for (auto& inst : bb)
+				if (auto alloca = llvm::dyn_cast<llvm::AllocaInst>(&inst))
+					objects.push_back(alloca);
+
+	for (auto alloca : objects)
+	{
+		std::set<llvm::Value*> seen;
+		if (!Escapes(alloca, false, seen, definition))
+			alloca->moveBefore(&*entry.getFirstInsertionPt());
+	}
+}
+
+csaw::value_t csaw::Environment::GetNew(const type_t& type)
+{ // from the runtime heap, so it outlives the frame; released with the innermost region around it, or collected with -gc
+	auto alloc = Module().getOrInsertFunction(m_GC ? "csaw_gc_alloc" : "csaw_alloc", llvm::FunctionType::get(Builder().getPtrTy(), { Builder().getInt64Ty() }, false));
+	auto ptr = Builder().CreateCall(alloc, { llvm::ConstantExpr::getSizeOf(type.element) });
+	Builder().CreateStore(llvm::Constant::getNullValue(type.element), ptr);
+	return value_t(ptr, type);
+}
+
 csaw::value_t csaw::Environment::CreateCall(const type_t& memberof, const std::string& name, const std::vector<value_t>& args, bool justAsking)
 {
 	std::vector<type_t> types;
-	std::vector<llvm::Value*> values;
 	for (auto& arg : args)
-	{
 		types.push_back(arg.ptrType);
-		values.push_back(arg.value);
-	}
 
-	auto fun = GetFunction(memberof, name, types);
+	auto fun = FindFunction(memberof, name, types);
+	if (!fun && !justAsking)
+		fun = FindConvertible(memberof, name, args);
+
 	if (!fun)
 	{
 		if (justAsking)
@@ -228,13 +771,54 @@ csaw::value_t csaw::Environment::CreateCall(const type_t& memberof, const std::s
 		throw;
 	}
 
-	if (fun.isconstructor)
+	return Invoke(fun, memberof, args, nullptr);
+}
+
+csaw::value_t csaw::Environment::CreateNew(const std::string& name, const std::vector<value_t>& args)
+{
+	std::vector<type_t> types;
+	for (auto& arg : args)
+		types.push_back(arg.ptrType);
+
+	auto fun = FindFunction(type_t(), name, types);
+	if (!fun)
+		fun = FindConvertible(type_t(), name, args);
+
+	if (!fun || !fun->isconstructor || !fun->type.type->isPointerTy())
+	{
+		llvm::errs() << "Cannot create '" << name << "' with new, only things that are not value things can\r\n";
+		throw;
+	}
+
+	return Invoke(fun, type_t(), args, GetNew(fun->type)());
+}
+
+csaw::value_t csaw::Environment::Invoke(const fun_t* fun, const type_t& memberof, const std::vector<value_t>& args, llvm::Value* my)
+{ // my is where a constructor builds its object, on the stack if null
+	std::vector<llvm::Value*> values;
+	for (size_t i = 0; i < args.size(); i++)
 	{
-		auto my = Environment::GetNull(fun.type);
-		values.insert(values.begin(), my());
+		if (i == 0 && IsValueThing(memberof) && !args[0]()->getType()->isPointerTy())
+		{ // "my" goes by address, a temporary gets a stack slot of its own
+			auto ptr = EntryAlloca(memberof.type);
+			Builder().CreateStore(args[0](), ptr);
+			values.push_back(ptr);
+		}
+		else if (i < fun->argtypes.size())
+			values.push_back(Cast(args[i], fun->argtypes[i])());
+		else if (args[i]()->getType()->isFloatTy()) // C varargs promote float to double and small integers to int
+			values.push_back(Builder().CreateFPExt(args[i](), Builder().getDoubleTy()));
+		else if (args[i]()->getType()->isIntegerTy() && args[i]()->getType()->getIntegerBitWidth() < 32)
+			values.push_back(Builder().CreateIntCast(args[i](), Builder().getInt32Ty(), IsSigned(args[i].ptrType)));
+		else
+			values.push_back(args[i]());
 	}
 
-	return value_t(Environment::Builder().CreateCall(fun(), values), fun.type);
+	if (fun->isconstructor)
+		values.insert(values.begin(), my ? my : GetNull(fun->type)());
+
+	auto callee = llvm::cast<llvm::Function>(Import(fun->fun));
+	return value_t(Environment::Builder().CreateCall(callee, values), fun->type);
 }
 
 csaw::value_t csaw::Environment::NextVarArg(const type_t& type, llvm::Value* vaptr)
@@ -280,8 +864,15 @@ csaw::value_t csaw::Environment::NextVarArg(const type_t& type, llvm::Value* vap
 	return value_t(value, type);
 }
 
-double csaw::Environment::Run()
+static void LazyCompileFailure()
 {
+	llvm::errs() << "Failed to compile function on first call\r\n";
+	exit(1);
+}
+
+double csaw::Environment::Run(const JITMode mode)
+{
+	Link();
 	FinishGlobalFunction();
 
 	if (llvm::verifyModule(Module(), &llvm::errs())) {
@@ -293,15 +884,118 @@ double csaw::Environment::Run()
 	llvm::InitializeNativeTargetAsmPrinter();
 	llvm::InitializeNativeTargetAsmParser();
 
-	// Create an LLJIT instance
-	auto builder = llvm::orc::LLJITBuilder().create();
-	if (!builder)
+	auto jtmb = llvm::orc::JITTargetMachineBuilder::detectHost();
+	if (!jtmb)
 	{
-		llvm::errs() << "Failed to create LLJIT instance : " << builder.takeError() << "\r\n";
+		llvm::errs() << "Failed to detect host: " << jtmb.takeError() << "\r\n";
 		return 1;
 	}
 
-	std::unique_ptr<llvm::orc::LLJIT> jit = std::move(*builder);
+	if (!IsHostCPU(m_CPU))
+		jtmb->setCPU(m_CPU);
+	if (!IsHostCPU(m_CPU) || !m_Features.empty())
+	{
+		jtmb->getFeatures() = llvm::SubtargetFeatures();
+		jtmb->addFeatures({ m_Features });
+	}
+	jtmb->setOptions(m_TargetOptions);
+	jtmb->setCodeGenOptLevel(CodeGenLevel(m_OptLevel));
+
+	auto machine = jtmb->createTargetMachine();
+	if (!machine)
+	{
+		llvm::errs() << "Failed to create target machine: " << machine.takeError() << "\r\n";
+		return 1;
+	}
+
+	Module().setDataLayout((*machine)->createDataLayout());
+
+	std::unique_ptr<ObjectCache> cache;
+	if (!m_CacheDir.empty() && mode == JIT_EAGER) // lazy partitions are not keyed, so they bypass the cache
+	{
+		// the key covers the unoptimized ir and everything that shapes the optimized object
+		auto target = jtmb->getTargetTriple().str() + ' ' + jtmb->getCPU() + ' ' + jtmb->getFeatures().getString()
+			+ " O" + std::to_string(m_OptLevel) + " contract" + std::to_string((int)m_TargetOptions.AllowFPOpFusion) + (m_FastMath ? " fast" : "");
+		cache = std::make_unique<ObjectCache>(m_CacheDir);
+		Module().setModuleIdentifier(ObjectCache::Key(Module(), target));
+	}
+
+	// partitions would each need their own cache key, so the cache keeps to a single module
+	auto parallel = mode == JIT_EAGER && m_Jobs > 1 && !cache;
+	if (parallel)
+		Optimize(Module(), machine->get(), m_OptLevel, OPT_SIMPLIFY);
+	else if (mode == JIT_EAGER && (!cache || !cache->Contains(Module()))) // a cached object needs neither optimization nor codegen
+		Optimize(Module(), machine->get(), m_OptLevel);
+
+	auto hostjtmb = *jtmb;
+
+	std::unique_ptr<llvm::orc::LLJIT> jit;
+	llvm::orc::LLLazyJIT* lazy = nullptr;
+
+	if (mode == JIT_LAZY)
+	{
+		// every function is its own partition, compiled and optimized on its first call
+		llvm::orc::LLLazyJITBuilder lazybuilder;
+		lazybuilder.setJITTargetMachineBuilder(std::move(*jtmb));
+		lazybuilder.setLazyCompileFailureAddr(llvm::orc::ExecutorAddr::fromPtr(&LazyCompileFailure));
+
+		auto builder = lazybuilder.create();
+		if (!builder)
+		{
+			llvm::errs() << "Failed to create LLLazyJIT instance : " << builder.takeError() << "\r\n";
+			return 1;
+		}
+
+		lazy = builder->get();
+		lazy->setPartitionFunction(llvm::orc::CompileOnDemandLayer::compileRequested);
+		lazy->getIRTransformLayer().setTransform([&hostjtmb](llvm::orc::ThreadSafeModule tsm, const llvm::orc::MaterializationResponsibility&) -> llvm::Expected<llvm::orc::ThreadSafeModule>
+		{
+			// functions may be compiled on several threads at once, and a target machine is not thread safe
+			auto lazymachine = hostjtmb.createTargetMachine();
+			if (!lazymachine)
+				return lazymachine.takeError();
+			tsm.withModuleDo([&lazymachine](llvm::Module& module) { Optimize(module, lazymachine->get(), m_OptLevel); });
+			return std::move(tsm);
+		});
+		jit = std::move(*builder);
+	}
+	else
+	{
+		// Create an LLJIT instance
+		llvm::orc::LLJITBuilder jitbuilder;
+		jitbuilder.setJITTargetMachineBuilder(std::move(*jtmb));
+		if (parallel)
+			jitbuilder.setNumCompileThreads(m_Jobs);
+		if (cache)
+			jitbuilder.setCompileFunctionCreator([&cache](llvm::orc::JITTargetMachineBuilder jtmb) -> llvm::Expected<std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>>
+			{
+				return std::make_unique<llvm::orc::ConcurrentIRCompiler>(std::move(jtmb), cache.get());
+			});
+		else if (mode == JIT_TIERED)
+			jitbuilder.setCompileFunctionCreator([](llvm::orc::JITTargetMachineBuilder jtmb) -> llvm::Expected<std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>>
+			{
+				return std::make_unique<TierCompiler>(std::move(jtmb));
+			});
+
+		auto builder = jitbuilder.create();
+		if (!builder)
+		{
+			llvm::errs() << "Failed to create LLJIT instance : " << builder.takeError() << "\r\n";
+			return 1;
+		}
+
+		jit = std::move(*builder);
+		if (parallel)
+			jit->getIRTransformLayer().setTransform([&hostjtmb](llvm::orc::ThreadSafeModule tsm, const llvm::orc::MaterializationResponsibility&) -> llvm::Expected<llvm::orc::ThreadSafeModule>
+			{
+				// runs on the compile threads, so every partition optimizes with its own target machine
+				auto partmachine = hostjtmb.createTargetMachine();
+				if (!partmachine)
+					return partmachine.takeError();
+				tsm.withModuleDo([&partmachine](llvm::Module& module) { Optimize(module, partmachine->get(), m_OptLevel, OPT_LATE); });
+				return std::move(tsm);
+			});
+	}
 
 	auto& es = jit->getExecutionSession();
 	auto& dl = jit->getDataLayout();
@@ -319,10 +1013,22 @@ double csaw::Environment::Run()
 		{ mangle("csaw_str_to_num"),  { llvm::orc::ExecutorAddr::fromPtr(&csaw_str_to_num), llvm::JITSymbolFlags() } },
 		{ mangle("csaw_chr_to_num"), { llvm::orc::ExecutorAddr::fromPtr(&csaw_chr_to_num), llvm::JITSymbolFlags() } },
 		{ mangle("csaw_num_to_str"), { llvm::orc::ExecutorAddr::fromPtr(&csaw_num_to_str), llvm::JITSymbolFlags() } },
+		{ mangle("csaw_str_from_c"), { llvm::orc::ExecutorAddr::fromPtr(&csaw_str_from_c), llvm::JITSymbolFlags() } },
 		{ mangle("csaw_num_to_chr"), { llvm::orc::ExecutorAddr::fromPtr(&csaw_num_to_chr), llvm::JITSymbolFlags() } },
 		{ mangle("csaw_str_cmp"), { llvm::orc::ExecutorAddr::fromPtr(&csaw_str_cmp), llvm::JITSymbolFlags() } },
 		{ mangle("csaw_str_len"), { llvm::orc::ExecutorAddr::fromPtr(&csaw_str_len), llvm::JITSymbolFlags() } },
 		{ mangle("csaw_str_get"), { llvm::orc::ExecutorAddr::fromPtr(&csaw_str_get), llvm::JITSymbolFlags() } },
+		{ mangle("csaw_str_eq"), { llvm::orc::ExecutorAddr::fromPtr(&csaw_str_eq), llvm::JITSymbolFlags() } },
+		{ mangle("csaw_str_cat"), { llvm::orc::ExecutorAddr::fromPtr(&csaw_str_cat), llvm::JITSymbolFlags() } },
+		{ mangle("csaw_str_sub"), { llvm::orc::ExecutorAddr::fromPtr(&csaw_str_sub), llvm::JITSymbolFlags() } },
+		{ mangle("csaw_alloc"), { llvm::orc::ExecutorAddr::fromPtr(&csaw_alloc), llvm::JITSymbolFlags() } },
+		{ mangle("csaw_region_begin"), { llvm::orc::ExecutorAddr::fromPtr(&csaw_region_begin), llvm::JITSymbolFlags() } },
+		{ mangle("csaw_region_end"), { llvm::orc::ExecutorAddr::fromPtr(&csaw_region_end), llvm::JITSymbolFlags() } },
+		{ mangle("csaw_gc_enable"), { llvm::orc::ExecutorAddr::fromPtr(&csaw_gc_enable), llvm::JITSymbolFlags() } },
+		{ mangle("csaw_gc_alloc"), { llvm::orc::ExecutorAddr::fromPtr(&csaw_gc_alloc), llvm::JITSymbolFlags() } },
+		{ mangle("csaw_gc_root"), { llvm::orc::ExecutorAddr::fromPtr(&csaw_gc_root), llvm::JITSymbolFlags() } },
+		{ mangle("csaw_gc_collect"), { llvm::orc::ExecutorAddr::fromPtr(&csaw_gc_collect), llvm::JITSymbolFlags() } },
+		{ mangle("csaw_gc_stats"), { llvm::orc::ExecutorAddr::fromPtr(&csaw_gc_stats), llvm::JITSymbolFlags() } },
 	};
 
 	if (auto error = jd.define(llvm::orc::absoluteSymbols(symbols)))
@@ -332,7 +1038,34 @@ double csaw::Environment::Run()
 	}
 
 	// Add the module to the JIT
-	if (auto error = jit->addIRModule(llvm::orc::ThreadSafeModule(std::move(m_Module), std::move(m_Context))))
+	std::unique_ptr<TieredJIT> tiers; // declared after jit, so its compile thread stops first
+	if (mode == JIT_TIERED)
+		tiers = std::make_unique<TieredJIT>(*jit, hostjtmb, m_TierThreshold);
+
+	auto add = [&]() -> llvm::Error
+	{
+		if (tiers)
+			return tiers->Add(std::move(m_Module), std::move(m_Context));
+
+		if (parallel)
+		{
+			auto partitions = Partition(Module(), m_Jobs);
+			for (size_t i = 0; i < partitions.size(); i++)
+			{
+				auto tsm = LoadPartition(partitions[i], Module().getModuleIdentifier() + '.' + std::to_string(i));
+				if (!tsm)
+					return tsm.takeError();
+				if (auto error = jit->addIRModule(std::move(*tsm)))
+					return error;
+			}
+			return llvm::Error::success();
+		}
+
+		auto tsm = llvm::orc::ThreadSafeModule(std::move(m_Module), std::move(m_Context));
+		return lazy ? lazy->addLazyIRModule(std::move(tsm)) : jit->addIRModule(std::move(tsm));
+	};
+
+	if (auto error = add())
 	{
 		llvm::errs() << "Failed to add module to JIT: " << error << "\r\n";
 		return 1;
@@ -360,16 +1093,25 @@ double csaw::Environment::Run()
 	auto mainFunc = reinterpret_cast<MainFuncType>(mainSymbol->getValue());
 
 	// Call the main function
-	return mainFunc();
+	auto code = mainFunc();
+
+	if (tiers)
+	{
+		tiers->Stop();
+		tiers->Report(llvm::errs());
+	}
+
+	return code;
 }
 
-void csaw::Environment::Compile(const std::string& filename)
+bool csaw::Environment::Compile(const std::string& filename)
 {
+	Link();
 	FinishGlobalFunction();
 
 	if (llvm::verifyModule(Module(), &llvm::errs())) {
 		llvm::errs() << "Failed to verify module\r\n";
-		return;
+		return false;
 	}
 
 	llvm::InitializeAllTargetInfos();
@@ -389,60 +1131,107 @@ void csaw::Environment::Compile(const std::string& filename)
 	if (!target)
 	{
 		llvm::errs() << "Failed to get target for triple '" << triple << "': " << error << "\r\n";
-		return;
+		return false;
 	}
 
-	auto cpu = "generic";
-	auto features = "";
+	auto cpu = IsHostCPU(m_CPU) ? llvm::sys::getHostCPUName().str() : m_CPU;
+	auto features = IsHostCPU(m_CPU) && m_Features.empty() ? HostFeatures() : m_Features;
 
-	llvm::TargetOptions opt;
-	auto machine = target->createTargetMachine(triple, cpu, features, opt, llvm::Reloc::PIC_);
+	auto machine = target->createTargetMachine(triple, cpu, features, m_TargetOptions, llvm::Reloc::PIC_, std::nullopt, CodeGenLevel(m_OptLevel));
 	Module().setDataLayout(machine->createDataLayout());
 
-	std::error_code ec;
-	llvm::raw_fd_ostream dst(filename, ec, llvm::sys::fs::OF_None);
+	std::filesystem::path path(filename);
+	auto partname = [&path](size_t i) { return (path.parent_path() / path.stem()).string() + '.' + std::to_string(i) + path.extension().string(); };
+	auto clean = [&partname](size_t first) { std::error_code ec; for (auto i = first; std::filesystem::remove(partname(i), ec); i++); };
 
-	if (ec)
+	if (m_Jobs <= 1)
 	{
-		llvm::errs() << "Failed to open file '" << filename << "': " << ec.message() << "\r\n";
-		return;
+		clean(0); // partition objects of an earlier parallel build would take precedence at link time
+		Optimize(Module(), machine, m_OptLevel);
+		return EmitObject(Module(), machine, filename);
 	}
 
-	llvm::legacy::PassManager pm;
-	auto type = llvm::CodeGenFileType::ObjectFile;
+	// inlining needs the whole module, everything after it runs per partition, one object each
+	Optimize(Module(), machine, m_OptLevel, OPT_SIMPLIFY);
+	auto partitions = Partition(Module(), m_Jobs);
 
-	if (machine->addPassesToEmitFile(pm, dst, nullptr, type))
+	std::error_code ec;
+	std::filesystem::remove(path, ec);
+	clean(partitions.size());
+
+	std::vector<char> emitted(partitions.size()); // written by one thread each, read after the pool is done
+	llvm::ThreadPool pool(llvm::hardware_concurrency(m_Jobs));
+	for (size_t i = 0; i < partitions.size(); i++)
+		pool.async([&, i]
+		{
+			auto name = partname(i);
+			auto tsm = LoadPartition(partitions[i], name);
+			if (!tsm)
+			{
+				llvm::errs() << "Failed to load partition '" << name << "': " << tsm.takeError() << "\r\n";
+				return;
+			}
+
+			// target machines are not thread safe, each partition gets its own
+			std::unique_ptr<llvm::TargetMachine> partmachine(target->createTargetMachine(triple, cpu, features, m_TargetOptions, llvm::Reloc::PIC_, std::nullopt, CodeGenLevel(m_OptLevel)));
+			tsm->withModuleDo([&](llvm::Module& module)
+			{
+				Optimize(module, partmachine.get(), m_OptLevel, OPT_LATE);
+				emitted[i] = EmitObject(module, partmachine.get(), name);
+			});
+		});
+	pool.wait();
+
+	// a missing partition would only show as undefined symbols at link time
+	auto failed = std::count(emitted.begin(), emitted.end(), false);
+	if (failed)
 	{
-		llvm::errs() << "Failed to emit file of type '" << (type == llvm::CodeGenFileType::AssemblyFile ? "AssemblyFile" : type == llvm::CodeGenFileType::ObjectFile ? "ObjectFile" : "Null") << "'\r\n";
-		return;
+		llvm::errs() << "Failed to emit " << failed << " of " << partitions.size() << " partitions\r\n";
+		clean(0);
+		return false;
 	}
-
-	pm.run(Module());
-	dst.flush();
+	return true;
 }
 
-void csaw::Environment::CreateGlobalFunction()
+void csaw::Environment::CreateGlobalFunction(const std::string& name)
 { // create function for global initializers
 	auto funtype = llvm::FunctionType::get(Builder().getVoidTy(), false);
-	auto fun = llvm::Function::Create(funtype, llvm::Function::ExternalLinkage, "__global__", Module());
+	m_Global = llvm::Function::Create(funtype, llvm::Function::ExternalLinkage, name, Module());
 
-	auto entry = llvm::BasicBlock::Create(Context(), "fun_entry", fun);
+	auto entry = llvm::BasicBlock::Create(Context(), "fun_entry", m_Global);
 	Builder().SetInsertPoint(entry);
 }
 
 void csaw::Environment::FinishGlobalFunction()
-{ // verify and optimize global initializer function
-	auto fun = Module().getFunction("__global__");
+{ // terminate and verify global initializer function
+	auto fun = m_Global;
+
+	if (m_GC) // before any initializer, so strings from the runtime are collected too
+	{
+		Builder().SetInsertPoint(&fun->getEntryBlock(), fun->getEntryBlock().begin());
+		Builder().CreateCall(Module().getOrInsertFunction("csaw_gc_enable", Builder().getVoidTy()));
+	}
 
 	Builder().SetInsertPoint(&fun->back());
 	Builder().CreateRetVoid();
 
 	if (llvm::verifyFunction(*fun, &llvm::errs()))
 	{
-		llvm::errs() << "Failed to verify function '__global__':\r\n";
+		llvm::errs() << "Failed to verify function '" << fun->getName() << "':\r\n";
 		fun->print(llvm::errs());
 		return;
 	}
+}
+
+void csaw::Environment::Export(const decl_t& decl)
+{ // fold the declaration into the digest and record it in the interface of the file being generated
+	m_Interface.update(std::to_string(decl.kind));
+	for (auto& field : decl.fields)
+	{
+		m_Interface.update(field);
+		m_Interface.update(llvm::StringRef("", 1));
+	}
 
-	Optimize(fun);
+	if (!m_Open.empty() && !m_Open.back().cached)
+		m_Open.back().iface->decls.push_back(decl);
 }
@@ -0,0 +1,119 @@
+#include "interface.h"
+#include "objectcache.h"
+
+#include <cstdint>
+#include <cstring>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+// layout, host endian: "CSI2", u32 deps, { str path, str hash }, u32 decls, { u8 kind, u32 fields, { str } }
+// where str = u32 size, bytes
+
+static const char MAGIC[4] = { 'C', 'S', 'I', '2' };
+
+static bool Read(const char*& pos, const char* end, uint32_t& value)
+{
+	if (end - pos < (ptrdiff_t)sizeof(value))
+		return false;
+	std::memcpy(&value, pos, sizeof(value));
+	pos += sizeof(value);
+	return true;
+}
+
+static bool Read(const char*& pos, const char* end, std::string& value)
+{
+	uint32_t size;
+	if (!Read(pos, end, size) || (uint32_t)(end - pos) < size)
+		return false;
+	value.assign(pos, size);
+	pos += size;
+	return true;
+}
+
+static bool Room(const char* pos, const char* end, uint32_t count, size_t size)
+{ // whether count entries of at least size bytes each can follow, so a corrupt count never allocates
+	return (uint64_t)count * size <= (uint64_t)(end - pos);
+}
+
+static void Write(llvm::raw_ostream& out, uint32_t value)
+{
+	out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void Write(llvm::raw_ostream& out, const std::string& value)
+{
+	Write(out, (uint32_t)value.size());
+	out << value;
+}
+
+std::unique_ptr<csaw::interface_t> csaw::LoadInterface(const std::filesystem::path& entry)
+{ // nullptr if the entry is missing or malformed
+	auto buffer = llvm::MemoryBuffer::getFile(entry.string(), false, false); // mapped, not copied
+	if (!buffer)
+		return nullptr;
+
+	auto pos = (*buffer)->getBufferStart();
+	auto end = (*buffer)->getBufferEnd();
+	if (end - pos < (ptrdiff_t)sizeof(MAGIC) || std::memcmp(pos, MAGIC, sizeof(MAGIC)))
+		return nullptr;
+	pos += sizeof(MAGIC);
+
+	auto iface = std::make_unique<interface_t>();
+
+	uint32_t count;
+	if (!Read(pos, end, count))
+		return nullptr;
+	if (!Room(pos, end, count, 8)) // path and hash, 4 bytes of size each at least
+		return nullptr;
+	iface->deps.resize(count);
+	for (auto& [path, hash] : iface->deps)
+		if (!Read(pos, end, path) || !Read(pos, end, hash))
+			return nullptr;
+
+	if (!Read(pos, end, count))
+		return nullptr;
+	if (!Room(pos, end, count, 5)) // kind and field count
+		return nullptr;
+	iface->decls.resize(count);
+	for (auto& decl : iface->decls)
+	{
+		if (pos == end || (unsigned char)*pos > DECL_FUN)
+			return nullptr;
+		decl.kind = (DeclKind)*pos++;
+
+		if (!Read(pos, end, count))
+			return nullptr;
+		if (!Room(pos, end, count, 4))
+			return nullptr;
+		decl.fields.resize(count);
+		for (auto& field : decl.fields)
+			if (!Read(pos, end, field))
+				return nullptr;
+	}
+
+	return iface;
+}
+
+void csaw::StoreInterface(const interface_t& iface, const std::filesystem::path& entry)
+{
+	StoreEntry(entry, [&iface](llvm::raw_ostream& dst)
+	{
+		dst.write(MAGIC, sizeof(MAGIC));
+		Write(dst, (uint32_t)iface.deps.size());
+		for (auto& [path, hash] : iface.deps)
+		{
+			Write(dst, path);
+			Write(dst, hash);
+		}
+
+		Write(dst, (uint32_t)iface.decls.size());
+		for (auto& decl : iface.decls)
+		{
+			dst << (char)decl.kind;
+			Write(dst, (uint32_t)decl.fields.size());
+			for (auto& field : decl.fields)
+				Write(dst, field);
+		}
+	});
+}
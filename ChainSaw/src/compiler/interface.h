@@ -0,0 +1,35 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace csaw
+{
+	enum DeclKind : unsigned char
+	{
+		DECL_INC, // canonical path
+		DECL_THING, // name, "value" if it is a value thing, then field name and type pairs
+		DECL_ALIAS, // alias, origin type
+		DECL_VAR, // name, type
+		DECL_FUN, // memberof, name, result type, symbol, "?" if vararg, "$" if constructor, then argument types
+	};
+
+	struct decl_t
+	{
+		DeclKind kind;
+		std::vector<std::string> fields; // types are spelled like Describe does
+	};
+
+	// precompiled interface of an included file: what it declares, in order, so that a cached
+	// file is replayed from here instead of being lexed and parsed again
+	struct interface_t
+	{
+		std::vector<std::pair<std::string, std::string>> deps; // every file it includes, canonical path -> content hash
+		std::vector<decl_t> decls;
+	};
+
+	std::unique_ptr<interface_t> LoadInterface(const std::filesystem::path& entry);
+	void StoreInterface(const interface_t& iface, const std::filesystem::path& entry);
+}
@@ -0,0 +1,84 @@
+#include "objectcache.h"
+
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+
+bool csaw::StoreEntry(const std::filesystem::path& entry, llvm::function_ref<void(llvm::raw_ostream&)> write)
+{
+	int fd;
+	llvm::SmallString<128> temp;
+	if (auto ec = llvm::sys::fs::createUniqueFile(entry.string() + "-%%%%%%.tmp", fd, temp))
+	{
+		llvm::errs() << "Failed to create temporary file for '" << entry.string() << "': " << ec.message() << "\r\n";
+		return false;
+	}
+
+	{
+		llvm::raw_fd_ostream dst(fd, true);
+		write(dst);
+		dst.close(); // flush the tail now, a late error would be fatal in the destructor
+		if (dst.has_error())
+		{
+			llvm::errs() << "Failed to write file '" << temp << "': " << dst.error().message() << "\r\n";
+			dst.clear_error();
+			llvm::sys::fs::remove(temp);
+			return false;
+		}
+	}
+
+	if (auto ec = llvm::sys::fs::rename(temp, entry.string()))
+	{
+		llvm::errs() << "Failed to rename '" << temp << "' to '" << entry.string() << "': " << ec.message() << "\r\n";
+		llvm::sys::fs::remove(temp);
+		return false;
+	}
+	return true;
+}
+
+std::string csaw::ObjectCache::Key(const llvm::Module& module, const std::string& target)
+{
+	std::string ir;
+	llvm::raw_string_ostream out(ir);
+	module.print(out, nullptr);
+	out << target;
+	out.flush();
+
+	llvm::SHA1 sha;
+	sha.update(ir);
+	return llvm::toHex(sha.final(), true);
+}
+
+bool csaw::ObjectCache::Contains(const llvm::Module& module) const
+{
+	std::error_code ec;
+	return std::filesystem::exists(Entry(module), ec);
+}
+
+void csaw::ObjectCache::notifyObjectCompiled(const llvm::Module* module, llvm::MemoryBufferRef object)
+{
+	std::error_code ec;
+	std::filesystem::create_directories(m_Directory, ec);
+	if (ec)
+	{
+		llvm::errs() << "Failed to create cache directory '" << m_Directory.string() << "': " << ec.message() << "\r\n";
+		return;
+	}
+
+	StoreEntry(Entry(*module), [&object](llvm::raw_ostream& dst) { dst << object.getBuffer(); });
+}
+
+std::unique_ptr<llvm::MemoryBuffer> csaw::ObjectCache::getObject(const llvm::Module* module)
+{
+	auto buffer = llvm::MemoryBuffer::getFile(Entry(*module).string(), false, false);
+	if (!buffer)
+		return nullptr;
+	return std::move(*buffer);
+}
+
+std::filesystem::path csaw::ObjectCache::Entry(const llvm::Module& module) const
+{
+	return m_Directory / (module.getModuleIdentifier() + ".o");
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <filesystem>
+
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#include <llvm/IR/Module.h>
+
+namespace csaw
+{
+	// writes a cache entry into a temporary file of its own next to it and renames that into place,
+	// so neither a concurrent run nor another thread ever reads or interleaves a half written entry
+	bool StoreEntry(const std::filesystem::path& entry, llvm::function_ref<void(llvm::raw_ostream&)> write);
+
+	// on-disk objects for the jit, one file per module identifier
+	class ObjectCache : public llvm::ObjectCache
+	{
+	public:
+		ObjectCache(const std::filesystem::path& directory)
+			: m_Directory(directory) {}
+
+		static std::string Key(const llvm::Module& module, const std::string& target);
+
+		bool Contains(const llvm::Module& module) const;
+
+		void notifyObjectCompiled(const llvm::Module* module, llvm::MemoryBufferRef object) override;
+		std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module* module) override;
+
+	private:
+		std::filesystem::path Entry(const llvm::Module& module) const;
+
+	private:
+		std::filesystem::path m_Directory;
+	};
+}
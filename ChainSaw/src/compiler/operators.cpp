@@ -1,169 +1,242 @@
 #include "compiler.h"
 
+// brings both operands to their common numeric type, false if either is not numeric
+static bool Promote(csaw::value_t& left, csaw::value_t& right)
+{
+	if (!csaw::IsPrimitive(left.ptrType) || !csaw::IsPrimitive(right.ptrType))
+		return false;
+
+	auto type = csaw::Common(left, right);
+	left = csaw::Cast(left, type);
+	right = csaw::Cast(right, type);
+	return true;
+}
+
+static bool IsFloat(const csaw::value_t& value)
+{
+	return value()->getType()->isFloatingPointTy();
+}
+
+static csaw::value_t Truth(llvm::Value* condition)
+{
+	return csaw::value_t(condition, csaw::type_t("bool", condition->getType()));
+}
+
+// integer operands use the instruction directly, floating point ones round-trip through i64
+static csaw::value_t Bitwise(const csaw::value_t& value, llvm::Value* result)
+{
+	if (!IsFloat(value))
+		return csaw::value_t(result, value.ptrType);
+	return csaw::Cast(csaw::value_t(result, csaw::type_t("i64", result->getType())), value.ptrType);
+}
+
+static llvm::Value* Integral(const csaw::value_t& value)
+{
+	return IsFloat(value) ? csaw::NumToInt(value()) : value();
+}
+
 csaw::value_t csaw::OpAdd(value_t left, value_t right)
 {
-	if (left()->getType()->isDoubleTy() && right()->getType()->isDoubleTy())
-		return value_t(Environment::Builder().CreateFAdd(left(), right()), type_t(left.ptrType));
+	if (!Promote(left, right))
+		return {};
 
-	return {};
+	if (IsFloat(left))
+		return value_t(Environment::Builder().CreateFAdd(left(), right()), left.ptrType);
+	return value_t(Environment::Builder().CreateAdd(left(), right()), left.ptrType);
 }
 
 csaw::value_t csaw::OpSub(value_t left, value_t right)
 {
-	if (left()->getType()->isDoubleTy() && right()->getType()->isDoubleTy())
-		return value_t(Environment::Builder().CreateFSub(left(), right()), type_t(left.ptrType));
+	if (!Promote(left, right))
+		return {};
 
-	return {};
+	if (IsFloat(left))
+		return value_t(Environment::Builder().CreateFSub(left(), right()), left.ptrType);
+	return value_t(Environment::Builder().CreateSub(left(), right()), left.ptrType);
 }
 
 csaw::value_t csaw::OpMul(value_t left, value_t right)
 {
-	if (left()->getType()->isDoubleTy() && right()->getType()->isDoubleTy())
-		return value_t(Environment::Builder().CreateFMul(left(), right()), type_t(left.ptrType));
+	if (!Promote(left, right))
+		return {};
 
-	return {};
+	if (IsFloat(left))
+		return value_t(Environment::Builder().CreateFMul(left(), right()), left.ptrType);
+	return value_t(Environment::Builder().CreateMul(left(), right()), left.ptrType);
 }
 
 csaw::value_t csaw::OpDiv(value_t left, value_t right)
 {
-	if (left()->getType()->isDoubleTy() && right()->getType()->isDoubleTy())
-		return value_t(Environment::Builder().CreateFDiv(left(), right()), type_t(left.ptrType));
+	if (!Promote(left, right))
+		return {};
 
-	return {};
+	if (IsFloat(left))
+		return value_t(Environment::Builder().CreateFDiv(left(), right()), left.ptrType);
+	if (IsSigned(left.ptrType))
+		return value_t(Environment::Builder().CreateSDiv(left(), right()), left.ptrType);
+	return value_t(Environment::Builder().CreateUDiv(left(), right()), left.ptrType);
 }
 
 csaw::value_t csaw::OpMod(value_t left, value_t right)
 {
-	if (left()->getType()->isDoubleTy() && right()->getType()->isDoubleTy())
-		return value_t(Environment::Builder().CreateFRem(left(), right()), type_t(left.ptrType));
+	if (!Promote(left, right))
+		return {};
 
-	return {};
+	if (IsFloat(left))
+		return value_t(Environment::Builder().CreateFRem(left(), right()), left.ptrType);
+	if (IsSigned(left.ptrType))
+		return value_t(Environment::Builder().CreateSRem(left(), right()), left.ptrType);
+	return value_t(Environment::Builder().CreateURem(left(), right()), left.ptrType);
 }
 
 csaw::value_t csaw::OpEQ(value_t left, value_t right)
 {
-	if (left()->getType()->isDoubleTy() && right()->getType()->isDoubleTy())
-		return value_t(BoolToNum(Environment::Builder().CreateFCmpOEQ(left(), right())), type_t(left.ptrType));
+	if (!Promote(left, right))
+		return {};
 
-	return {};
+	if (IsFloat(left))
+		return Truth(Environment::Builder().CreateFCmpOEQ(left(), right()));
+	return Truth(Environment::Builder().CreateICmpEQ(left(), right()));
 }
 
 csaw::value_t csaw::OpNE(value_t left, value_t right)
 {
-	if (left()->getType()->isDoubleTy() && right()->getType()->isDoubleTy())
-		return value_t(BoolToNum(Environment::Builder().CreateFCmpONE(left(), right())), type_t(left.ptrType));
+	if (!Promote(left, right))
+		return {};
 
-	return {};
+	if (IsFloat(left))
+		return Truth(Environment::Builder().CreateFCmpONE(left(), right()));
+	return Truth(Environment::Builder().CreateICmpNE(left(), right()));
 }
 
 csaw::value_t csaw::OpLT(value_t left, value_t right)
 {
-	if (left()->getType()->isDoubleTy() && right()->getType()->isDoubleTy())
-		return value_t(BoolToNum(Environment::Builder().CreateFCmpOLT(left(), right())), type_t(left.ptrType));
+	if (!Promote(left, right))
+		return {};
 
-	return {};
+	if (IsFloat(left))
+		return Truth(Environment::Builder().CreateFCmpOLT(left(), right()));
+	if (IsSigned(left.ptrType))
+		return Truth(Environment::Builder().CreateICmpSLT(left(), right()));
+	return Truth(Environment::Builder().CreateICmpULT(left(), right()));
 }
 
 csaw::value_t csaw::OpGT(value_t left, value_t right)
 {
-	if (left()->getType()->isDoubleTy() && right()->getType()->isDoubleTy())
-		return value_t(BoolToNum(Environment::Builder().CreateFCmpOGT(left(), right())), type_t(left.ptrType));
+	if (!Promote(left, right))
+		return {};
 
-	return {};
+	if (IsFloat(left))
+		return Truth(Environment::Builder().CreateFCmpOGT(left(), right()));
+	if (IsSigned(left.ptrType))
+		return Truth(Environment::Builder().CreateICmpSGT(left(), right()));
+	return Truth(Environment::Builder().CreateICmpUGT(left(), right()));
 }
 
 csaw::value_t csaw::OpLTE(value_t left, value_t right)
 {
-	if (left()->getType()->isDoubleTy() && right()->getType()->isDoubleTy())
-		return value_t(BoolToNum(Environment::Builder().CreateFCmpOLE(left(), right())), type_t(left.ptrType));
+	if (!Promote(left, right))
+		return {};
 
-	return {};
+	if (IsFloat(left))
+		return Truth(Environment::Builder().CreateFCmpOLE(left(), right()));
+	if (IsSigned(left.ptrType))
+		return Truth(Environment::Builder().CreateICmpSLE(left(), right()));
+	return Truth(Environment::Builder().CreateICmpULE(left(), right()));
 }
 
 csaw::value_t csaw::OpGTE(value_t left, value_t right)
 {
-	if (left()->getType()->isDoubleTy() && right()->getType()->isDoubleTy())
-		return value_t(BoolToNum(Environment::Builder().CreateFCmpOGE(left(), right())), type_t(left.ptrType));
+	if (!Promote(left, right))
+		return {};
 
-	return {};
+	if (IsFloat(left))
+		return Truth(Environment::Builder().CreateFCmpOGE(left(), right()));
+	if (IsSigned(left.ptrType))
+		return Truth(Environment::Builder().CreateICmpSGE(left(), right()));
+	return Truth(Environment::Builder().CreateICmpUGE(left(), right()));
 }
 
 csaw::value_t csaw::OpLAnd(value_t left, value_t right)
 {
-	if (left()->getType()->isDoubleTy() && right()->getType()->isDoubleTy())
-		return value_t(BoolToNum(Environment::Builder().CreateLogicalAnd(NumToBool(left()), NumToBool(right()))), type_t(left.ptrType));
+	if (!IsPrimitive(left.ptrType) || !IsPrimitive(right.ptrType))
+		return {};
 
-	return {};
+	return Truth(Environment::Builder().CreateLogicalAnd(ToBool(left()), ToBool(right())));
 }
 
 csaw::value_t csaw::OpLOr(value_t left, value_t right)
 {
-	if (left()->getType()->isDoubleTy() && right()->getType()->isDoubleTy())
-		return value_t(BoolToNum(Environment::Builder().CreateLogicalOr(NumToBool(left()), NumToBool(right()))), type_t(left.ptrType));
+	if (!IsPrimitive(left.ptrType) || !IsPrimitive(right.ptrType))
+		return {};
 
-	return {};
+	return Truth(Environment::Builder().CreateLogicalOr(ToBool(left()), ToBool(right())));
 }
 
 csaw::value_t csaw::OpAnd(value_t left, value_t right)
 {
-	if (left()->getType()->isDoubleTy() && right()->getType()->isDoubleTy())
-		return value_t(IntToNum(Environment::Builder().CreateAnd(NumToInt(left()), NumToInt(right()))), type_t(left.ptrType));
+	if (!Promote(left, right))
+		return {};
 
-	return {};
+	return Bitwise(left, Environment::Builder().CreateAnd(Integral(left), Integral(right)));
 }
 
 csaw::value_t csaw::OpOr(value_t left, value_t right)
 {
-	if (left()->getType()->isDoubleTy() && right()->getType()->isDoubleTy())
-		return value_t(IntToNum(Environment::Builder().CreateOr(NumToInt(left()), NumToInt(right()))), type_t(left.ptrType));
+	if (!Promote(left, right))
+		return {};
 
-	return {};
+	return Bitwise(left, Environment::Builder().CreateOr(Integral(left), Integral(right)));
 }
 
 csaw::value_t csaw::OpXOr(value_t left, value_t right)
 {
-	if (left()->getType()->isDoubleTy() && right()->getType()->isDoubleTy())
-		return value_t(IntToNum(Environment::Builder().CreateXor(NumToInt(left()), NumToInt(right()))), type_t(left.ptrType));
+	if (!Promote(left, right))
+		return {};
 
-	return {};
+	return Bitwise(left, Environment::Builder().CreateXor(Integral(left), Integral(right)));
 }
 
 csaw::value_t csaw::OpShL(value_t left, value_t right)
 {
-	if (left()->getType()->isDoubleTy() && right()->getType()->isDoubleTy())
-		return value_t(IntToNum(Environment::Builder().CreateShl(NumToInt(left()), NumToInt(right()))), type_t(left.ptrType));
+	if (!Promote(left, right))
+		return {};
 
-	return {};
+	return Bitwise(left, Environment::Builder().CreateShl(Integral(left), Integral(right)));
 }
 
 csaw::value_t csaw::OpShR(value_t left, value_t right)
 {
-	if (left()->getType()->isDoubleTy() && right()->getType()->isDoubleTy())
-		return value_t(IntToNum(Environment::Builder().CreateAShr(NumToInt(left()), NumToInt(right()))), type_t(left.ptrType));
+	if (!Promote(left, right))
+		return {};
 
-	return {};
+	if (IsFloat(left) || IsSigned(left.ptrType))
+		return Bitwise(left, Environment::Builder().CreateAShr(Integral(left), Integral(right)));
+	return Bitwise(left, Environment::Builder().CreateLShr(left(), right()));
 }
 
 csaw::value_t csaw::OpNot(value_t value)
 {
-	if (value()->getType()->isDoubleTy())
-		return value_t(BoolToNum(Environment::Builder().CreateNot(NumToBool(value()))), type_t(value.ptrType));
+	if (!IsPrimitive(value.ptrType))
+		return {};
 
-	return {};
+	return Truth(Environment::Builder().CreateNot(ToBool(value())));
 }
 
 csaw::value_t csaw::OpNeg(value_t value)
 {
-	if (value()->getType()->isDoubleTy())
-		return value_t(Environment::Builder().CreateFNeg(value()), type_t(value.ptrType));
+	if (!IsPrimitive(value.ptrType))
+		return {};
 
-	return {};
+	if (IsFloat(value))
+		return value_t(Environment::Builder().CreateFNeg(value()), value.ptrType);
+	return value_t(Environment::Builder().CreateNeg(value()), value.ptrType);
 }
 
 csaw::value_t csaw::OpInv(value_t value)
 {
-	if (value()->getType()->isDoubleTy())
-		return value_t(IntToNum(Environment::Builder().CreateNot(NumToInt(value()))), type_t(value.ptrType));
+	if (!IsPrimitive(value.ptrType))
+		return {};
 
-	return {};
+	return Bitwise(value, Environment::Builder().CreateNot(Integral(value)));
 }
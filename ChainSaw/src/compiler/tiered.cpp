@@ -0,0 +1,248 @@
+#include "compiler.h"
+#include "tiered.h"
+
+#include <chrono>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+
+csaw::TieredJIT* csaw::TieredJIT::s_Active = nullptr;
+
+llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> csaw::TierCompiler::operator()(llvm::Module& module)
+{
+	auto jtmb = m_JTMB;
+	jtmb.setCodeGenOptLevel(module.getModuleIdentifier().starts_with("tier1.") ? llvm::CodeGenOpt::Aggressive : llvm::CodeGenOpt::None);
+
+	auto machine = jtmb.createTargetMachine();
+	if (!machine)
+		return machine.takeError();
+
+	llvm::orc::SimpleCompiler compile(**machine);
+	return compile(module);
+}
+
+csaw::TieredJIT::TieredJIT(llvm::orc::LLJIT& jit, llvm::orc::JITTargetMachineBuilder jtmb, unsigned threshold)
+	: m_JIT(jit), m_JTMB(std::move(jtmb)), m_Threshold(threshold)
+{
+	m_Stubs = llvm::orc::createLocalIndirectStubsManagerBuilder(m_JTMB.getTargetTriple())();
+	s_Active = this;
+	m_Worker = std::thread(&TieredJIT::Work, this);
+}
+
+csaw::TieredJIT::~TieredJIT()
+{
+	Stop();
+	s_Active = nullptr;
+}
+
+llvm::Error csaw::TieredJIT::Add(std::unique_ptr<llvm::Module> module, std::unique_ptr<llvm::LLVMContext> context)
+{
+	Instrument(*module);
+
+	auto& es = m_JIT.getExecutionSession();
+	llvm::orc::MangleAndInterner mangle(es, m_JIT.getDataLayout());
+
+	// stubs exist before the module, so its calls resolve to them; their targets are set once tier 0 is compiled
+	llvm::orc::IndirectStubsManager::StubInitsMap inits;
+	for (auto& tier : m_Tiers)
+		inits[tier.name] = { llvm::orc::ExecutorAddr(), llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable };
+	if (auto error = m_Stubs->createStubs(inits))
+		return error;
+
+	llvm::orc::SymbolMap symbols
+	{
+		{ mangle("csaw_tier_up"), { llvm::orc::ExecutorAddr::fromPtr(&TierUp), llvm::JITSymbolFlags() } },
+	};
+	for (auto& tier : m_Tiers)
+		symbols[mangle(tier.name)] = { m_Stubs->findStub(tier.name, true).getAddress(), llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable };
+
+	if (auto error = m_JIT.getMainJITDylib().define(llvm::orc::absoluteSymbols(symbols)))
+		return error;
+
+	if (auto error = m_JIT.addIRModule(llvm::orc::ThreadSafeModule(std::move(module), std::move(context))))
+		return error;
+
+	for (auto& tier : m_Tiers)
+	{
+		auto body = m_JIT.lookup(tier.name + ".t0");
+		if (!body)
+			return body.takeError();
+		if (auto error = m_Stubs->updatePointer(tier.name, *body))
+			return error;
+	}
+
+	return llvm::Error::success();
+}
+
+void csaw::TieredJIT::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stop = true;
+	}
+	m_Wake.notify_all();
+
+	if (m_Worker.joinable())
+		m_Worker.join();
+}
+
+void csaw::TieredJIT::Report(llvm::raw_ostream& out) const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	size_t count = 0;
+	for (auto& tier : m_Tiers)
+		count += tier.promoted;
+
+	out << "Tiered JIT: " << count << " of " << m_Tiers.size() << " functions promoted to -O3 after " << m_Threshold << " calls\r\n";
+	for (auto& tier : m_Tiers)
+		if (tier.promoted)
+			out << "  " << tier.name << " (" << llvm::format("%.1f", tier.millis) << " ms)\r\n";
+}
+
+void csaw::TieredJIT::TierUp(unsigned index)
+{
+	auto tiers = s_Active;
+	if (!tiers)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(tiers->m_Mutex);
+		tiers->m_Queue.push_back(index);
+	}
+	tiers->m_Wake.notify_one();
+}
+
+void csaw::TieredJIT::Instrument(llvm::Module& module)
+{
+	// promoted bodies live in their own modules and link against this one by name
+	for (auto& global : module.globals())
+		if (global.hasLocalLinkage())
+			global.setLinkage(llvm::GlobalValue::ExternalLinkage);
+
+	llvm::raw_svector_ostream bitcode(m_Bitcode);
+	llvm::WriteBitcodeToFile(module, bitcode);
+
+	std::vector<llvm::Function*> funs;
+	for (auto& fun : module)
+		if (!fun.isDeclaration() && !fun.hasLocalLinkage() && fun.getName() != "__global__" && fun.getName() != "main")
+			funs.push_back(&fun); // local functions are runtime intrinsics, inlined wherever they are used
+
+	auto& context = module.getContext();
+	auto i32 = llvm::Type::getInt32Ty(context);
+	auto tierup = module.getOrInsertFunction("csaw_tier_up", llvm::FunctionType::get(llvm::Type::getVoidTy(context), { i32 }, false));
+
+	for (auto fun : funs)
+	{
+		auto index = (unsigned)m_Tiers.size();
+		m_Tiers.push_back({ fun->getName().str() });
+		auto& name = m_Tiers.back().name;
+
+		// callers, including the body itself, go through the stub from now on
+		fun->setName(name + ".t0");
+		auto stub = llvm::Function::Create(fun->getFunctionType(), llvm::GlobalValue::ExternalLinkage, name, module);
+		fun->replaceAllUsesWith(stub);
+
+		auto counter = new llvm::GlobalVariable(module, i32, false, llvm::GlobalValue::InternalLinkage, llvm::ConstantInt::get(i32, 0), name + ".calls");
+
+		llvm::IRBuilder<> builder(&*fun->getEntryBlock().getFirstNonPHIOrDbgOrAlloca()); // keep the stack slots in the entry block
+		auto calls = builder.CreateAdd(builder.CreateLoad(i32, counter), builder.getInt32(1));
+		builder.CreateStore(calls, counter);
+		auto hot = builder.CreateICmpEQ(calls, builder.getInt32(m_Threshold));
+
+		auto then = llvm::SplitBlockAndInsertIfThen(hot, &*builder.GetInsertPoint(), false);
+		builder.SetInsertPoint(then);
+		builder.CreateCall(tierup, { builder.getInt32(index) });
+	}
+
+	module.setModuleIdentifier("tier0");
+}
+
+void csaw::TieredJIT::Promote(unsigned index)
+{
+	auto begin = std::chrono::steady_clock::now();
+	auto& name = m_Tiers[index].name;
+
+	auto context = std::make_unique<llvm::LLVMContext>();
+	auto module = llvm::parseBitcodeFile(llvm::MemoryBufferRef(llvm::StringRef(m_Bitcode.data(), m_Bitcode.size()), "tier1"), *context);
+	if (!module)
+	{
+		llvm::errs() << "Failed to read tier 0 bitcode: " << module.takeError() << "\r\n";
+		return;
+	}
+
+	// keep only the hot body; everything else is linked from tier 0 but stays visible to the inliner
+	for (auto& global : (*module)->globals())
+		if (!global.isDeclaration())
+		{
+			global.setInitializer(nullptr);
+			global.setLinkage(llvm::GlobalValue::ExternalLinkage);
+		}
+
+	for (auto& fun : **module)
+	{
+		if (fun.isDeclaration() || fun.hasLocalLinkage() || fun.getName() == name)
+			continue;
+		if (fun.getName() == "__global__" || fun.getName() == "main")
+			fun.deleteBody();
+		else
+			fun.setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+	}
+
+	(*module)->getFunction(name)->setName(name + ".t1");
+	(*module)->setModuleIdentifier("tier1." + name);
+
+	auto jtmb = m_JTMB;
+	jtmb.setCodeGenOptLevel(llvm::CodeGenOpt::Aggressive);
+	auto machine = jtmb.createTargetMachine();
+	if (!machine)
+	{
+		llvm::errs() << "Failed to create target machine: " << machine.takeError() << "\r\n";
+		return;
+	}
+
+	Environment::Optimize(**module, machine->get(), 3);
+
+	if (auto error = m_JIT.addIRModule(llvm::orc::ThreadSafeModule(std::move(*module), std::move(context))))
+	{
+		llvm::errs() << "Failed to add tier 1 module for '" << name << "': " << error << "\r\n";
+		return;
+	}
+
+	auto body = m_JIT.lookup(name + ".t1");
+	if (!body)
+	{
+		llvm::errs() << "Failed to compile tier 1 body of '" << name << "': " << body.takeError() << "\r\n";
+		return;
+	}
+
+	if (auto error = m_Stubs->updatePointer(name, *body))
+	{
+		llvm::errs() << "Failed to update stub of '" << name << "': " << error << "\r\n";
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Tiers[index].promoted = true;
+	m_Tiers[index].millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+void csaw::TieredJIT::Work()
+{
+	while (true)
+	{
+		unsigned index;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Wake.wait(lock, [this] { return m_Stop || !m_Queue.empty(); });
+			if (m_Stop)
+				return;
+
+			index = m_Queue.front();
+			m_Queue.pop_front();
+		}
+
+		Promote(index);
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/IndirectionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+
+namespace csaw
+{
+	// picks the codegen level per module: tier 0 modules get fast isel, promoted bodies full codegen
+	class TierCompiler : public llvm::orc::IRCompileLayer::IRCompiler
+	{
+	public:
+		TierCompiler(llvm::orc::JITTargetMachineBuilder jtmb)
+			: IRCompiler(llvm::orc::irManglingOptionsFromTargetOptions(jtmb.getOptions())), m_JTMB(std::move(jtmb)) {}
+
+		llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> operator()(llvm::Module& module) override;
+
+	private:
+		llvm::orc::JITTargetMachineBuilder m_JTMB;
+	};
+
+	// every function except __global__ and main is entered through an indirect stub that first
+	// points at its unoptimized tier 0 body. that body counts its calls and, once it reaches the
+	// threshold, queues itself for the background thread, which rebuilds it at -O3 from the
+	// uninstrumented ir and swaps the stub over.
+	class TieredJIT
+	{
+	public:
+		TieredJIT(llvm::orc::LLJIT& jit, llvm::orc::JITTargetMachineBuilder jtmb, unsigned threshold);
+		~TieredJIT();
+
+		llvm::Error Add(std::unique_ptr<llvm::Module> module, std::unique_ptr<llvm::LLVMContext> context);
+		void Stop();
+		void Report(llvm::raw_ostream& out) const;
+
+	private:
+		static void TierUp(unsigned index);
+
+		void Instrument(llvm::Module& module);
+		void Promote(unsigned index);
+		void Work();
+
+	private:
+		struct tier_t
+		{
+			std::string name;
+			bool promoted = false;
+			double millis = 0; // background compile time
+		};
+
+		static TieredJIT* s_Active;
+
+		llvm::orc::LLJIT& m_JIT;
+		llvm::orc::JITTargetMachineBuilder m_JTMB;
+		unsigned m_Threshold;
+
+		std::unique_ptr<llvm::orc::IndirectStubsManager> m_Stubs;
+		llvm::SmallVector<char, 0> m_Bitcode; // the module before instrumentation
+		std::vector<tier_t> m_Tiers;
+
+		mutable std::mutex m_Mutex;
+		std::condition_variable m_Wake;
+		std::deque<unsigned> m_Queue;
+		bool m_Stop = false;
+		std::thread m_Worker;
+	};
+}
@@ -24,12 +24,27 @@ int main(int argc, const char** argv)
 			continue;
 		}
 
+		if (arg == "--fast-math") // a switch, though spelled like an option, same as -fast-math
+		{
+			flags.push_back("fast-math");
+			continue;
+		}
+
 		if (arg.find("--") == 0) // option
 		{
 			nextOption = arg.substr(2);
 			continue;
 		}
 
+		if (arg == "-j" || (arg.size() > 2 && arg.find("-j") == 0 && isdigit(arg[2]))) // -j N or -jN, same as --jobs N
+		{
+			if (arg.size() > 2)
+				options["jobs"] = arg.substr(2);
+			else
+				nextOption = "jobs";
+			continue;
+		}
+
 		if (arg.find("-") == 0) // flag
 		{
 			flags.push_back(arg.substr(1));
@@ -62,6 +77,8 @@ int csaw::Shell(
 	std::string input;
 
 	Environment::InitEnvironment();
+	if (options.contains("cache-dir")) // included files, the standard library above all, load from their interfaces
+		Environment::CacheDir(options.at("cache-dir"));
 	auto env = std::make_shared<Environment>(path);
 
 	while (true)
@@ -84,6 +101,14 @@ int csaw::Shell(
 	return 0;
 }
 
+static bool Count(const std::map<std::string, std::string>& options, const std::string& name, unsigned& count)
+{ // false with a message if the option is not a plain unsigned number
+	if (!llvm::StringRef(options.at(name)).getAsInteger(10, count))
+		return true;
+	std::cerr << "Option '--" << name << "' expects a count, got '" << options.at(name) << "'" << std::endl;
+	return false;
+}
+
 int csaw::Run(
 	const std::string& path,
 	const std::string& filename,
@@ -94,24 +119,66 @@ int csaw::Run(
 	Environment::InitEnvironment();
 	auto env = std::make_shared<Environment>(filename);
 
+	for (unsigned level = 0; level <= 3; level++)
+		if (flags & ("O" + std::to_string(level)))
+			Environment::OptLevel(level);
+
+	auto cpu = options.contains("cpu") ? options.at("cpu") : "";
+	auto features = options.contains("features") ? options.at("features") : "";
+	if (flags & "march=native")
+		cpu = "native";
+	Environment::Target(cpu, features);
+
+	if (options.contains("fp-contract"))
+		Environment::FPContract(options.at("fp-contract"));
+	if (flags & "fast-math")
+		Environment::FastMath(true);
+	if (options.contains("cache-dir"))
+		Environment::CacheDir(options.at("cache-dir"));
+	if (options.contains("tier-threshold"))
+	{
+		unsigned calls;
+		if (!Count(options, "tier-threshold", calls))
+			return 1;
+		if (!calls) // the counter is compared after it is incremented, so 0 would never promote
+		{
+			std::cerr << "Option '--tier-threshold' must be at least 1" << std::endl;
+			return 1;
+		}
+		Environment::TierThreshold(calls);
+	}
+	if (options.contains("jobs"))
+	{
+		unsigned jobs;
+		if (!Count(options, "jobs", jobs))
+			return 1;
+		Environment::Jobs(jobs);
+	}
+	if (flags & "gc")
+		Environment::GC(true);
+
+	Environment::Include(std::filesystem::weakly_canonical(filename)); // a file including the main file gets nothing
 	if (!csaw::Parse(env, filename))
 	{
 		std::cerr << "Undefined file name '" << filename << "'" << std::endl;
 		return 1;
 	}
 
+	if (flags & "time")
+		std::cerr << "Parse " << Times().parse * 1000 << " ms, GenIR " << Times().genir * 1000 << " ms" << std::endl;
+
+	Environment::Link(); // included files were generated into modules of their own
 	Environment::Module().setSourceFileName(filename);
-	//Environment::Module().print(llvm::outs(), nullptr);
+	if (flags & "emit-llvm")
+		Environment::Module().print(llvm::outs(), nullptr);
 
-	if (flags & "jit")
+	if (flags & "jit" || flags & "jit-lazy" || flags & "jit-tiered")
 	{
-		auto code = Environment::Run();
+		auto code = Environment::Run(flags & "jit-tiered" ? JIT_TIERED : flags & "jit-lazy" ? JIT_LAZY : JIT_EAGER);
 		std::cout << "Exit Code " << code << std::endl;
 	}
-	else
-	{
-		Environment::Compile("output.o");
-	}
+	else if (!Environment::Compile("output.o"))
+		return 1;
 
 	return 0;
 }
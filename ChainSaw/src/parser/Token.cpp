@@ -5,11 +5,6 @@ std::ostream& csaw::operator<<(std::ostream& out, const Token& token)
 	return out << "[ '" << token.Value << "' -> " << token.Type << " (" << token.Line << ") ]";
 }
 
-std::ostream& csaw::operator<<(std::ostream& out, const std::shared_ptr<Token>& token)
-{
-	return out << "[ '" << token->Value << "' -> " << token->Type << " (" << token->Line << ") ]";
-}
-
 std::ostream& csaw::operator<<(std::ostream& out, const TokenType& type)
 {
 	switch (type)
@@ -23,3 +18,22 @@ std::ostream& csaw::operator<<(std::ostream& out, const TokenType& type)
 	default: return out << "WTF";
 	}
 }
+
+
+std::ostream& csaw::operator<<(std::ostream& out, const TokenId& id)
+{
+	switch (id)
+	{
+	case KEYWORD_ALIAS: return out << "alias";
+	case KEYWORD_ELSE: return out << "else";
+	case KEYWORD_FOR: return out << "for";
+	case KEYWORD_IF: return out << "if";
+	case KEYWORD_INC: return out << "inc";
+	case KEYWORD_NEW: return out << "new";
+	case KEYWORD_REGION: return out << "region";
+	case KEYWORD_RET: return out << "ret";
+	case KEYWORD_THING: return out << "thing";
+	case KEYWORD_WHILE: return out << "while";
+	default: return out << "WTF";
+	}
+}
\ No newline at end of file
@@ -2,238 +2,238 @@
 
 #include <iostream>
 
-std::shared_ptr<csaw::Expr> csaw::Parser::NextExpr()
+csaw::Expr* csaw::Parser::NextExpr()
 {
 	return NextConExpr();
 }
 
-std::shared_ptr<csaw::Expr> csaw::Parser::NextConExpr()
+csaw::Expr* csaw::Parser::NextConExpr()
 {
 	auto expr = NextBinAndExpr();
 
-	while (At("?")) {
+	while (At('?')) {
 		Next(); // skip ?
 		auto then = NextExpr();
-		ExpectAndNext(":"); // skip :
+		ExpectAndNext(':'); // skip :
 		auto else_ = NextExpr();
-		expr = std::make_shared<ConExpr>(expr, then, else_);
+		expr = m_Arena.New<ConExpr>(expr, then, else_);
 	}
 
 	return expr;
 }
 
-std::shared_ptr<csaw::Expr> csaw::Parser::NextBinAndExpr()
+csaw::Expr* csaw::Parser::NextBinAndExpr()
 {
 	auto left = NextBinOrExpr();
 
-	while (At("&")) {
-		std::string operator_ = m_Current->Value;
+	while (At('&')) {
+		std::string operator_(m_Current->Value);
 		Next(); // skip operator
 
-		if (At("=")) {
+		if (At('=')) {
 			operator_ += m_Current->Value;
 			Next(); // skip =
-			left = std::make_shared<BinExpr>(left, NextExpr(), operator_);
-			//left = std::make_shared<AssignExpr>(left, std::make_shared<BinExpr>(left, NextExpr(), operator_));
+			left = m_Arena.New<BinExpr>(left, NextExpr(), operator_);
+			//left = m_Arena.New<AssignExpr>(left, m_Arena.New<BinExpr>(left, NextExpr(), operator_));
 			continue;
 		}
-		else if (At("&")) {
+		else if (At('&')) {
 			operator_ += m_Current->Value;
 			Next(); // skip operator
 		}
 
-		left = std::make_shared<BinExpr>(left, NextBinOrExpr(), operator_);
+		left = m_Arena.New<BinExpr>(left, NextBinOrExpr(), operator_);
 	}
 
 	return left;
 }
 
-std::shared_ptr<csaw::Expr> csaw::Parser::NextBinOrExpr()
+csaw::Expr* csaw::Parser::NextBinOrExpr()
 {
 	auto left = NextBinXOrExpr();
 
-	while (At("|")) {
-		std::string operator_ = m_Current->Value;
+	while (At('|')) {
+		std::string operator_(m_Current->Value);
 		Next(); // skip operator
 
-		if (At("=")) {
+		if (At('=')) {
 			operator_ += m_Current->Value;
 			Next(); // skip =
-			left = std::make_shared<BinExpr>(left, NextExpr(), operator_);
-			//left = std::make_shared<AssignExpr>(left, std::make_shared<BinExpr>(left, NextExpr(), operator_));
+			left = m_Arena.New<BinExpr>(left, NextExpr(), operator_);
+			//left = m_Arena.New<AssignExpr>(left, m_Arena.New<BinExpr>(left, NextExpr(), operator_));
 			continue;
 		}
-		else if (At("|")) {
+		else if (At('|')) {
 			operator_ += m_Current->Value;
 			Next(); // skip operator
 		}
 
-		left = std::make_shared<BinExpr>(left, NextBinXOrExpr(), operator_);
+		left = m_Arena.New<BinExpr>(left, NextBinXOrExpr(), operator_);
 	}
 
 	return left;
 }
 
-std::shared_ptr<csaw::Expr> csaw::Parser::NextBinXOrExpr()
+csaw::Expr* csaw::Parser::NextBinXOrExpr()
 {
 	auto left = NextBinCmpExpr();
 
-	while (At("^")) {
-		std::string operator_ = m_Current->Value;
+	while (At('^')) {
+		std::string operator_(m_Current->Value);
 		Next(); // skip operator
 
-		if (At("=")) {
+		if (At('=')) {
 			operator_ += m_Current->Value;
 			Next(); // skip =
-			left = std::make_shared<BinExpr>(left, NextExpr(), operator_);
-			//left = std::make_shared<AssignExpr>(left, std::make_shared<BinExpr>(left, NextExpr(), operator_));
+			left = m_Arena.New<BinExpr>(left, NextExpr(), operator_);
+			//left = m_Arena.New<AssignExpr>(left, m_Arena.New<BinExpr>(left, NextExpr(), operator_));
 			continue;
 		}
 
-		left = std::make_shared<BinExpr>(left, NextBinCmpExpr(), operator_);
+		left = m_Arena.New<BinExpr>(left, NextBinCmpExpr(), operator_);
 	}
 
 	return left;
 }
 
-std::shared_ptr<csaw::Expr> csaw::Parser::NextBinCmpExpr()
+csaw::Expr* csaw::Parser::NextBinCmpExpr()
 {
 	auto left = NextBinSumExpr();
 
-	while (At("=") || At("!") || At("<") || At(">")) {
-		std::string operator_ = m_Current->Value;
+	while (At('=') || At('!') || At('<') || At('>')) {
+		std::string operator_(m_Current->Value);
 		Next(); // skip operator
 
-		if (At(operator_) || At("=")) {
+		if (At(operator_[0]) || At('=')) {
 			operator_ += m_Current->Value;
 			Next(); // skip operator
 		}
 		else if (operator_ == "=") {
-			left = std::make_shared<BinExpr>(left, NextExpr(), operator_);
-			//left = std::make_shared<AssignExpr>(left, NextExpr());
+			left = m_Arena.New<BinExpr>(left, NextExpr(), operator_);
+			//left = m_Arena.New<AssignExpr>(left, NextExpr());
 			continue;
 		}
 
-		left = std::make_shared<BinExpr>(left, NextBinSumExpr(), operator_);
+		left = m_Arena.New<BinExpr>(left, NextBinSumExpr(), operator_);
 	}
 
 	return left;
 }
 
-std::shared_ptr<csaw::Expr> csaw::Parser::NextBinSumExpr()
+csaw::Expr* csaw::Parser::NextBinSumExpr()
 {
 	auto left = NextBinProExpr();
 
-	while (At("+") || At("-")) {
-		std::string operator_ = m_Current->Value;
+	while (At('+') || At('-')) {
+		std::string operator_(m_Current->Value);
 		Next(); // skip operator
 
-		if (At("=")) {
+		if (At('=')) {
 			operator_ += m_Current->Value;
 			Next(); // skip =
-			left = std::make_shared<BinExpr>(left, NextExpr(), operator_);
-			//left = std::make_shared<AssignExpr>(left, std::make_shared<BinExpr>(left, NextExpr(), operator_));
+			left = m_Arena.New<BinExpr>(left, NextExpr(), operator_);
+			//left = m_Arena.New<AssignExpr>(left, m_Arena.New<BinExpr>(left, NextExpr(), operator_));
 			continue;
 		}
-		else if (At(operator_)) {
+		else if (At(operator_[0])) {
 			operator_ += m_Current->Value;
 			Next(); // skip operator
-			left = std::make_shared<UnExpr>(operator_, left);
-			//left = std::make_shared<AssignExpr>(left, std::make_shared<BinExpr>(left, std::make_shared<NumExpr>(1), operator_));
+			left = m_Arena.New<UnExpr>(operator_, left);
+			//left = m_Arena.New<AssignExpr>(left, m_Arena.New<BinExpr>(left, m_Arena.New<NumExpr>(1), operator_));
 			continue;
 		}
 
-		left = std::make_shared<BinExpr>(left, NextBinProExpr(), operator_);
+		left = m_Arena.New<BinExpr>(left, NextBinProExpr(), operator_);
 	}
 
 	return left;
 }
 
-std::shared_ptr<csaw::Expr> csaw::Parser::NextBinProExpr()
+csaw::Expr* csaw::Parser::NextBinProExpr()
 {
 	auto left = NextCallExpr();
 
-	while (At("*") || At("/") || At("%")) {
-		std::string operator_ = m_Current->Value;
+	while (At('*') || At('/') || At('%')) {
+		std::string operator_(m_Current->Value);
 		Next(); // skip operator
 
-		if (At("=")) {
+		if (At('=')) {
 			operator_ += m_Current->Value;
 			Next(); // skip =
-			left = std::make_shared<BinExpr>(left, NextExpr(), operator_);
-			//left = std::make_shared<AssignExpr>(left, std::make_shared<BinExpr>(left, NextExpr(), operator_));
+			left = m_Arena.New<BinExpr>(left, NextExpr(), operator_);
+			//left = m_Arena.New<AssignExpr>(left, m_Arena.New<BinExpr>(left, NextExpr(), operator_));
 			continue;
 		}
 
-		left = std::make_shared<BinExpr>(left, NextCallExpr(), operator_);
+		left = m_Arena.New<BinExpr>(left, NextCallExpr(), operator_);
 	}
 
 	return left;
 }
 
-std::shared_ptr<csaw::Expr> csaw::Parser::NextCallExpr()
+csaw::Expr* csaw::Parser::NextCallExpr()
 {
 	auto expr = NextIndexExpr();
 
-	while (At("(")) {
+	while (At('(')) {
 		Next(); // skip (
-		std::vector<std::shared_ptr<Expr>> arguments;
-		while (!AtEof() && !At(")")) {
+		std::vector<Expr*> arguments;
+		while (!AtEof() && !At(')')) {
 			arguments.push_back(NextExpr());
-			if (!At(")"))
-				ExpectAndNext(","); // skip ,
+			if (!At(')'))
+				ExpectAndNext(','); // skip ,
 		}
-		ExpectAndNext(")"); // skip )
+		ExpectAndNext(')'); // skip )
 
-		expr = std::make_shared<CallExpr>(expr, arguments);
+		expr = m_Arena.New<CallExpr>(expr, arguments);
 
-		if (At("["))
+		if (At('['))
 			expr = NextIndexExpr(expr);
 
-		if (At("."))
+		if (At('.'))
 			expr = NextMemExpr(expr);
 	}
 
 	return expr;
 }
 
-std::shared_ptr<csaw::Expr> csaw::Parser::NextIndexExpr()
+csaw::Expr* csaw::Parser::NextIndexExpr()
 {
 	return NextIndexExpr(NextMemExpr());
 }
 
-std::shared_ptr<csaw::Expr> csaw::Parser::NextIndexExpr(std::shared_ptr<Expr> expr)
+csaw::Expr* csaw::Parser::NextIndexExpr(Expr* expr)
 {
-	while (At("[")) {
+	while (At('[')) {
 		Next(); // skip [
 		auto index = NextExpr();
-		ExpectAndNext("]"); // skip ]
-		expr = std::make_shared<IndexExpr>(expr, index);
+		ExpectAndNext(']'); // skip ]
+		expr = m_Arena.New<IndexExpr>(expr, index);
 
-		if (At("."))
+		if (At('.'))
 			expr = NextMemExpr(expr);
 	}
 
 	return expr;
 }
 
-std::shared_ptr<csaw::Expr> csaw::Parser::NextMemExpr()
+csaw::Expr* csaw::Parser::NextMemExpr()
 {
 	return NextMemExpr(NextPrimExpr());
 }
 
-std::shared_ptr<csaw::Expr> csaw::Parser::NextMemExpr(std::shared_ptr<Expr> expr)
+csaw::Expr* csaw::Parser::NextMemExpr(Expr* expr)
 {
-	while (At(".")) {
+	while (At('.')) {
 		Next(); // skip .
-		expr = std::make_shared<MemExpr>(expr, m_Current->Value);
+		expr = m_Arena.New<MemExpr>(expr, std::string(m_Current->Value));
 		ExpectAndNext(TOKEN_IDENTIFIER);
 	}
 
 	return expr;
 }
 
-std::shared_ptr<csaw::Expr> csaw::Parser::NextPrimExpr()
+csaw::Expr* csaw::Parser::NextPrimExpr()
 {
 	if (AtEof())
 	{
@@ -241,35 +241,53 @@ std::shared_ptr<csaw::Expr> csaw::Parser::NextPrimExpr()
 		throw;
 	}
 
+	if (At(KEYWORD_NEW))
+	{
+		Next(); // skip "new"
+		std::string type(m_Current->Value);
+		ExpectAndNext(TOKEN_IDENTIFIER);
+
+		ExpectAndNext('('); // skip (
+		std::vector<Expr*> arguments;
+		while (!AtEof() && !At(')')) {
+			arguments.push_back(NextExpr());
+			if (!At(')'))
+				ExpectAndNext(','); // skip ,
+		}
+		ExpectAndNext(')'); // skip )
+
+		return m_Arena.New<NewExpr>(type, arguments);
+	}
+
 	switch (m_Current->Type)
 	{
 	case TOKEN_IDENTIFIER:
 	{
-		auto expr = std::make_shared<IdExpr>(m_Current->Value);
+		auto expr = m_Arena.New<IdExpr>(std::string(m_Current->Value));
 		Next(); // skip id
 		return expr;
 	}
 	case TOKEN_NUMBER:
 	{
-		std::shared_ptr<Expr> expr;
+		Expr* expr = nullptr;
 		if (m_Current->Value.rfind("0x", 0) != std::string::npos)
-			expr = std::make_shared<NumExpr>(m_Current->Value.substr(2), 16);
+			expr = m_Arena.New<NumExpr>(std::string(m_Current->Value.substr(2)), 16);
 		else if (m_Current->Value.rfind("0b", 0) != std::string::npos)
-			expr = std::make_shared<NumExpr>(m_Current->Value.substr(2), 2);
+			expr = m_Arena.New<NumExpr>(std::string(m_Current->Value.substr(2)), 2);
 		else
-			expr = std::make_shared<NumExpr>(m_Current->Value);
+			expr = m_Arena.New<NumExpr>(std::string(m_Current->Value));
 		Next(); // skip num
 		return expr;
 	}
 	case TOKEN_STRING:
 	{
-		auto expr = std::make_shared<StrExpr>(m_Current->Value);
+		auto expr = m_Arena.New<StrExpr>(std::string(m_Current->Value));
 		Next(); // skip str
 		return expr;
 	}
 	case TOKEN_CHAR:
 	{
-		auto expr = std::make_shared<ChrExpr>(m_Current->Value[0]);
+		auto expr = m_Arena.New<ChrExpr>(m_Current->Value.empty() ? 0 : m_Current->Value[0]);
 		Next(); // skip chr
 		return expr;
 	}
@@ -277,66 +295,66 @@ std::shared_ptr<csaw::Expr> csaw::Parser::NextPrimExpr()
 		break;
 	}
 
-	if (m_Current->Value == "(")
+	if (At('('))
 	{
 		Next(); // skip (
 		auto expr = NextExpr();
-		ExpectAndNext(")"); // skip )
+		ExpectAndNext(')'); // skip )
 		return expr;
 	}
 
-	if (m_Current->Value == "-")
+	if (At('-'))
 	{
 		Next(); // skip -
-		return std::make_shared<UnExpr>("-", NextCallExpr());
+		return m_Arena.New<UnExpr>("-", NextCallExpr());
 	}
-	if (m_Current->Value == "!")
+	if (At('!'))
 	{
 		Next(); // skip !
-		return std::make_shared<UnExpr>("!", NextCallExpr());
+		return m_Arena.New<UnExpr>("!", NextCallExpr());
 	}
-	if (m_Current->Value == "~")
+	if (At('~'))
 	{
 		Next(); // skip ~
-		return std::make_shared<UnExpr>("~", NextCallExpr());
+		return m_Arena.New<UnExpr>("~", NextCallExpr());
 	}
-	if (m_Current->Value == "?")
+	if (At('?'))
 	{
 		Next(); // skip ?
-		if (At("?"))
+		if (At('?'))
 		{
 			Next(); // skip ?
-			return std::make_shared<VarArgExpr>();
+			return m_Arena.New<VarArgExpr>();
 		}
-		return std::make_shared<VarArgExpr>(NextType());
+		return m_Arena.New<VarArgExpr>(NextType());
 	}
 
-	if (m_Current->Value == "[")
+	if (At('['))
 	{ // lambda!
 		Next(); // skip [
-		std::vector<std::shared_ptr<IdExpr>> passed;
-		while (!AtEof() && !At("]"))
+		std::vector<IdExpr*> passed;
+		while (!AtEof() && !At(']'))
 		{
-			passed.push_back(std::dynamic_pointer_cast<IdExpr>(NextPrimExpr()));
-			if (!At("]"))
-				ExpectAndNext(","); // skip ,
+			passed.push_back(As<IdExpr>(NextPrimExpr()));
+			if (!At(']'))
+				ExpectAndNext(','); // skip ,
 		}
-		ExpectAndNext("]"); // skip ]
+		ExpectAndNext(']'); // skip ]
 
-		ExpectAndNext("("); // skip (
+		ExpectAndNext('('); // skip (
 		std::vector<ASTParameter> parameters;
-		while (!AtEof() && !At(")"))
+		while (!AtEof() && !At(')'))
 		{
 			parameters.push_back(NextParameter());
-			if (!At(")"))
-				ExpectAndNext(","); // skip ,
+			if (!At(')'))
+				ExpectAndNext(','); // skip ,
 		}
-		ExpectAndNext(")"); // skip )
+		ExpectAndNext(')'); // skip )
 
 		auto body = NextStmt(false);
-		return std::make_shared<LambdaExpr>(passed, parameters, body);
+		return m_Arena.New<LambdaExpr>(passed, parameters, body);
 	}
 
-	std::cerr << "unhandled token " << m_Current << std::endl;
+	std::cerr << "unhandled token " << *m_Current << std::endl;
 	throw;
 }
@@ -1,7 +1,41 @@
 #include "parser.h"
 
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <sstream>
+
+csaw::times_t& csaw::Times()
+{
+	static times_t times;
+	return times;
+}
+
+template <typename Source>
+static void GenAll(const std::shared_ptr<csaw::Environment>& env, Source&& source)
+{ // lexing and parsing alternate with generating per statement, so each is timed on its own
+	using clock = std::chrono::steady_clock;
+	auto& times = csaw::Times();
+
+	auto begin = clock::now();
+	csaw::Parser parser(std::forward<Source>(source));
+	parser.Next();
+	times.parse += std::chrono::duration<double>(clock::now() - begin).count();
+
+	while (!parser.AtEof())
+	{
+		begin = clock::now();
+		auto stmt = parser.NextStmt(true);
+		auto parsed = clock::now();
+		auto before = times.parse + times.genir;
+		csaw::GenIR(env, stmt);
+		auto generated = clock::now();
+		auto included = times.parse + times.genir - before; // an included file already added its own times
+
+		times.parse += std::chrono::duration<double>(parsed - begin).count();
+		times.genir += std::chrono::duration<double>(generated - parsed).count() - included;
+	}
+}
 
 bool csaw::Parse(const std::shared_ptr<Environment>& env, const std::string& filename)
 {
@@ -14,13 +48,7 @@ bool csaw::Parse(const std::shared_ptr<Environment>& env, const std::string& fil
 
 bool csaw::Parse(const std::shared_ptr<Environment>& env, std::istream& stream)
 {
-	Parser parser(stream);
-	parser.Next();
-	while (!parser.AtEof())
-	{
-		auto stmt = parser.NextStmt(true);
-		GenIR(env, stmt);
-	}
+	GenAll(env, stream);
 
 	return true;
 }
@@ -31,42 +59,69 @@ bool csaw::ParseInc(const std::shared_ptr<Environment>& env, const std::filesyst
 	if (!stream)
 		return false;
 
+	std::ostringstream buffer;
+	buffer << stream.rdbuf();
+	auto source = std::move(buffer).str();
+
 	auto prev = env->Path();
 	env->Path(filepath);
 
-	Parser parser(stream);
-	parser.Next();
-	while (!parser.AtEof())
+	// a cached file is neither lexed nor parsed, its interface declares what its module defines
+	if (auto iface = Environment::BeginUnit(filepath, source))
 	{
-		auto stmt = parser.NextStmt(true);
-		GenIR(env, stmt);
+		for (auto& decl : iface->decls)
+			Declare(env, decl);
+	}
+	else
+	{
+		GenAll(env, std::move(source));
 	}
 
+	Environment::EndUnit();
 	env->Path(prev);
 
 	return true;
 }
 
+csaw::Parser::Parser(std::istream& stream)
+{
+	std::ostringstream buffer;
+	buffer << stream.rdbuf();
+	m_Source = std::move(buffer).str();
+	tokenize();
+}
+
+csaw::Parser::Parser(std::string&& source)
+	: m_Source(std::move(source))
+{
+	tokenize();
+}
+
+void csaw::Parser::tokenize()
+{
+	m_Tokens.reserve(m_Source.size() / 4);
+	do
+		m_Tokens.push_back(lex());
+	while (m_Tokens.back().Type != TOKEN_EOF);
+}
+
 int csaw::Parser::read()
 {
-	int c = m_Stream.get();
-	if (m_Index < m_Limit)
-		m_Peek[m_Index++] = c;
-	return c;
+	if (m_Pos >= m_Source.size())
+		return -1;
+	return (unsigned char)m_Source[m_Pos++];
 }
 
-void csaw::Parser::mark(int limit)
+int csaw::Parser::peek() const
 {
-	m_Peek = new char[limit];
-	m_Index = 0;
-	m_Limit = limit;
+	if (m_Pos >= m_Source.size())
+		return -1;
+	return (unsigned char)m_Source[m_Pos];
 }
 
-void csaw::Parser::reset()
+std::string_view csaw::Parser::view(size_t begin) const
 {
-	for (int i = m_Index - 1; i >= 0; i--)
-		m_Stream.putback(m_Peek[i]);
-	m_Limit = 0;
+	return std::string_view(m_Source).substr(begin, m_Pos - begin);
 }
 
 static bool isignore(int c)
@@ -74,6 +129,27 @@ static bool isignore(int c)
 	return 0x00 <= c && c <= 0x20;
 }
 
+static int keyword(std::string_view value)
+{
+	static const std::pair<std::string_view, int> KEYWORDS[] = {
+		{ "alias", csaw::KEYWORD_ALIAS },
+		{ "else", csaw::KEYWORD_ELSE },
+		{ "for", csaw::KEYWORD_FOR },
+		{ "if", csaw::KEYWORD_IF },
+		{ "inc", csaw::KEYWORD_INC },
+		{ "new", csaw::KEYWORD_NEW },
+		{ "region", csaw::KEYWORD_REGION },
+		{ "ret", csaw::KEYWORD_RET },
+		{ "thing", csaw::KEYWORD_THING },
+		{ "while", csaw::KEYWORD_WHILE },
+	};
+
+	for (auto& [name, id] : KEYWORDS)
+		if (name == value)
+			return id;
+	return csaw::ID_NONE;
+}
+
 static int escape(int c)
 {
 	switch (c) {
@@ -96,7 +172,7 @@ static int escape(int c)
 	}
 }
 
-std::shared_ptr<csaw::Token> csaw::Parser::Next()
+csaw::Token csaw::Parser::lex()
 {
 	int c = read();
 
@@ -105,7 +181,7 @@ std::shared_ptr<csaw::Token> csaw::Parser::Next()
 			m_Line++;
 
 	if (c < 0)
-		return m_Current = std::make_shared<Token>(m_Line);
+		return Token(m_Line);
 
 	if (c == '#') {
 		c = read();
@@ -115,77 +191,78 @@ std::shared_ptr<csaw::Token> csaw::Parser::Next()
 				m_Line++;
 		if (LIMIT == '\n')
 			m_Line++;
-		return Next();
+		return lex();
 	}
 
 	if (isalpha(c) || c == '_') {
-		std::string value;
-		do {
-			value += c;
-			mark(1);
-			c = read();
-		} while (isalnum(c) || c == '_');
-		reset();
+		size_t begin = m_Pos - 1;
+		while (isalnum(peek()) || peek() == '_')
+			m_Pos++;
 
-		return m_Current = std::make_shared<Token>(TOKEN_IDENTIFIER, value, m_Line);
+		auto value = view(begin);
+		return Token(TOKEN_IDENTIFIER, keyword(value), value, m_Line);
 	}
 
 	if (isdigit(c)) {
-		std::string value;
-		do {
-			value += c;
-			mark(1);
-			int p = c;
-			c = read();
-			if (((p == 'e' || p == 'E') && c == '-')) {
-				value += c;
-				mark(1);
-				c = read();
-			}
-		} while (isxdigit(c) || c == '.' || c == 'x' || c == 'b');
-		reset();
-
-		return m_Current = std::make_shared<Token>(TOKEN_NUMBER, value, m_Line);
-	}
-
-	if (c == '"') {
-		std::string value;
-		c = read();
-		while (c != '"' && c >= 0) {
-			if (c == '\\') {
-				value += escape(read());
-				c = read();
+		size_t begin = m_Pos - 1;
+		while (true) {
+			int p = m_Source[m_Pos - 1];
+			c = peek();
+			if ((p == 'e' || p == 'E') && c == '-') {
+				m_Pos++;
 				continue;
 			}
-			value += c;
-			c = read();
+			if (!(isxdigit(c) || c == '.' || c == 'x' || c == 'b'))
+				break;
+			m_Pos++;
 		}
 
-		return m_Current = std::make_shared<Token>(TOKEN_STRING, value, m_Line);
+		return Token(TOKEN_NUMBER, ID_NONE, view(begin), m_Line);
 	}
 
-	if (c == '\'') {
-		std::string value;
+	if (c == '"' || c == '\'') {
+		const int DELIMITER = c;
+		const TokenType type = c == '"' ? TOKEN_STRING : TOKEN_CHAR;
+
+		size_t begin = m_Pos;
+		while ((c = peek()) != DELIMITER && c >= 0 && c != '\\')
+			m_Pos++;
+
+		if (c != '\\') { // no escape sequences, the literal is a plain slice of the source
+			auto value = view(begin);
+			read(); // skip delimiter
+			return Token(type, ID_NONE, value, m_Line);
+		}
+
+		std::string& value = m_Escaped.emplace_back(view(begin));
 		c = read();
-		while (c != '\'' && c >= 0) {
+		while (c != DELIMITER && c >= 0) {
 			if (c == '\\') {
 				value += escape(read());
 				c = read();
+				continue;
 			}
-
 			value += c;
 			c = read();
 		}
 
-		return m_Current = std::make_shared<Token>(TOKEN_CHAR, value, m_Line);
+		return Token(type, ID_NONE, value, m_Line);
 	}
 
-	return m_Current = std::make_shared<Token>(TOKEN_OPERATOR, std::string{ (char)c }, m_Line);
+	return Token(TOKEN_OPERATOR, c, view(m_Pos - 1), m_Line);
+}
+
+const csaw::Token& csaw::Parser::Next()
+{
+	m_Current = &m_Tokens[m_Next];
+	if (m_Next + 1 < m_Tokens.size())
+		m_Next++;
+	return *m_Current;
 }
 
-std::shared_ptr<csaw::Token> csaw::Parser::Current()
+const csaw::Token& csaw::Parser::Current()
 {
-	return m_Current;
+	return *m_Current;
 }
 
 bool csaw::Parser::AtEof() const
@@ -198,6 +275,16 @@ bool csaw::Parser::At(const std::string& value) const
 	return !AtEof() && m_Current->Value == value;
 }
 
+bool csaw::Parser::At(const char op) const
+{
+	return m_Current->Type == TOKEN_OPERATOR && m_Current->Id == op;
+}
+
+bool csaw::Parser::At(const TokenId keyword) const
+{
+	return m_Current->Type == TOKEN_IDENTIFIER && m_Current->Id == keyword;
+}
+
 bool csaw::Parser::At(const TokenType type) const
 {
 	return !AtEof() && m_Current->Type == type;
@@ -207,7 +294,23 @@ bool csaw::Parser::Expect(const std::string& value) const
 {
 	if (At(value))
 		return true;
-	std::cerr << "unexpected token " << m_Current << ", expected value '" << value << "'" << std::endl;
+	std::cerr << "unexpected token " << *m_Current << ", expected value '" << value << "'" << std::endl;
+	throw;
+}
+
+bool csaw::Parser::Expect(const char op) const
+{
+	if (At(op))
+		return true;
+	std::cerr << "unexpected token " << *m_Current << ", expected value '" << op << "'" << std::endl;
+	throw;
+}
+
+bool csaw::Parser::Expect(const TokenId keyword) const
+{
+	if (At(keyword))
+		return true;
+	std::cerr << "unexpected token " << *m_Current << ", expected keyword '" << keyword << "'" << std::endl;
 	throw;
 }
 
@@ -215,7 +318,7 @@ bool csaw::Parser::Expect(const TokenType type) const
 {
 	if (At(type))
 		return true;
-	std::cerr << "unexpected token " << m_Current << ", expected type '" << type << "'" << std::endl;
+	std::cerr << "unexpected token " << *m_Current << ", expected type '" << type << "'" << std::endl;
 	throw;
 }
 
@@ -226,6 +329,20 @@ bool csaw::Parser::ExpectAndNext(const std::string& value)
 	return true;
 }
 
+bool csaw::Parser::ExpectAndNext(const char op)
+{
+	Expect(op);
+	Next();
+	return true;
+}
+
+bool csaw::Parser::ExpectAndNext(const TokenId keyword)
+{
+	Expect(keyword);
+	Next();
+	return true;
+}
+
 bool csaw::Parser::ExpectAndNext(const TokenType type)
 {
 	Expect(type);
@@ -238,13 +355,13 @@ std::shared_ptr<csaw::ASTType> csaw::Parser::NextType()
 	return NextType(NextIndexExpr());
 }
 
-std::shared_ptr<csaw::ASTType> csaw::Parser::NextType(const std::shared_ptr<Expr>& type)
+std::shared_ptr<csaw::ASTType> csaw::Parser::NextType(Expr* type)
 {
-	if (auto t = std::dynamic_pointer_cast<IdExpr>(type))
+	if (auto t = As<IdExpr>(type))
 		return ASTType::Get(t->Value);
-	if (auto t = std::dynamic_pointer_cast<IndexExpr>(type)) {
+	if (auto t = As<IndexExpr>(type)) {
 		auto type = NextType(t->Object);
-		auto size = (size_t)std::dynamic_pointer_cast<NumExpr>(t->Index)->Value;
+		auto size = (size_t)As<NumExpr>(t->Index)->Value;
 		return ASTType::Get(type, size);
 	}
 
@@ -254,9 +371,9 @@ std::shared_ptr<csaw::ASTType> csaw::Parser::NextType(const std::shared_ptr<Expr
 
 csaw::ASTParameter csaw::Parser::NextParameter()
 {
-	auto pname = m_Current->Value;
+	std::string pname(m_Current->Value);
 	ExpectAndNext(TOKEN_IDENTIFIER); // skip name
-	ExpectAndNext(":"); // skip :
+	ExpectAndNext(':'); // skip :
 	auto ptype = NextType();
 	return ASTParameter(pname, ptype);
 }
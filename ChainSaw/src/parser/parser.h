@@ -2,12 +2,23 @@
 
 #include "../compiler/compiler.h"
 
+#include <deque>
+#include <string_view>
+
 namespace csaw
 {
 	bool Parse(const std::shared_ptr<Environment>& env, const std::string& filename);
 	bool Parse(const std::shared_ptr<Environment>& env, std::istream& stream);
 	bool ParseInc(const std::shared_ptr<Environment>& env, const std::filesystem::path& filepath);
 
+	struct times_t // seconds spent in each phase, summed over every parsed file, reported by -time
+	{
+		double parse = 0;
+		double genir = 0;
+	};
+
+	times_t& Times();
+
 	enum TokenType
 	{
 		TOKEN_EOF = 0,
@@ -18,83 +29,113 @@ namespace csaw
 		TOKEN_OPERATOR,
 	};
 
+	enum TokenId
+	{
+		ID_NONE = 0,
+		// operators use their character code as id,
+		// keywords are numbered above the character range
+		KEYWORD_ALIAS = 0x100,
+		KEYWORD_ELSE,
+		KEYWORD_FOR,
+		KEYWORD_IF,
+		KEYWORD_INC,
+		KEYWORD_NEW,
+		KEYWORD_REGION,
+		KEYWORD_RET,
+		KEYWORD_THING,
+		KEYWORD_WHILE,
+	};
+
 	struct Token
 	{
-		Token(TokenType type, const std::string& value, int line)
-			: Type(type), Value(value), Line(line) {}
+		Token(TokenType type, int id, std::string_view value, int line)
+			: Type(type), Id(id), Value(value), Line(line) {}
 		Token(int line)
-			: Token(TOKEN_EOF, "", line) {}
+			: Token(TOKEN_EOF, ID_NONE, "", line) {}
 
-		const TokenType Type;
-		const std::string Value;
-		const int Line;
+		TokenType Type;
+		int Id;
+		std::string_view Value; // view into the parser source or its escaped literal storage
+		int Line;
 	};
 
 	std::ostream& operator<<(std::ostream& out, const Token& token);
-	std::ostream& operator<<(std::ostream& out, const std::shared_ptr<Token>& token);
 	std::ostream& operator<<(std::ostream& out, const TokenType& type);
+	std::ostream& operator<<(std::ostream& out, const TokenId& id);
 
 	class Parser
 	{
 	public:
-		Parser(std::istream& stream)
-			: m_Stream(stream) {}
+		Parser(std::istream& stream);
+		Parser(std::string&& source);
 
 	private:
 		int read();
-		void mark(int limit);
-		void reset();
+		int peek() const;
+		std::string_view view(size_t begin) const;
+		Token lex();
+		void tokenize();
 
 	public:
-		std::shared_ptr<Token> Next();
-		std::shared_ptr<Token> Current();
+		const Token& Next();
+		const Token& Current();
 
 		bool AtEof() const;
 		bool At(const std::string& value) const;
+		bool At(const char op) const;
+		bool At(const TokenId keyword) const;
 		bool At(const TokenType type) const;
 		bool Expect(const std::string& value) const;
+		bool Expect(const char op) const;
+		bool Expect(const TokenId keyword) const;
 		bool Expect(const TokenType type) const;
 		bool ExpectAndNext(const std::string& value);
+		bool ExpectAndNext(const char op);
+		bool ExpectAndNext(const TokenId keyword);
 		bool ExpectAndNext(const TokenType type);
 
 		std::shared_ptr<ASTType> NextType();
-		std::shared_ptr<ASTType> NextType(const std::shared_ptr<Expr>& type);
+		std::shared_ptr<ASTType> NextType(Expr* type);
 		ASTParameter NextParameter();
 
-		std::shared_ptr<Stmt> NextStmt(bool end);
-		std::shared_ptr<EnclosedStmt> NextEnclosedStmt();
-		std::shared_ptr<AliasStmt> NextAliasStmt(bool end);
-		std::shared_ptr<ForStmt> NextForStmt(bool end);
-		std::shared_ptr<FunStmt> NextFunStmt();
-		std::shared_ptr<IfStmt> NextIfStmt();
-		std::shared_ptr<IncStmt> NextIncStmt(bool end);
-		std::shared_ptr<RetStmt> NextRetStmt(bool end);
-		std::shared_ptr<ThingStmt> NextThingStmt(bool end);
-		std::shared_ptr<WhileStmt> NextWhileStmt(bool end);
-		std::shared_ptr<VarStmt> NextVarStmt(const std::shared_ptr<Expr>& expr, bool end);
-
-		std::shared_ptr<Expr> NextExpr();
-		std::shared_ptr<Expr> NextConExpr();
-		std::shared_ptr<Expr> NextBinAndExpr();
-		std::shared_ptr<Expr> NextBinOrExpr();
-		std::shared_ptr<Expr> NextBinXOrExpr();
-		std::shared_ptr<Expr> NextBinCmpExpr();
-		std::shared_ptr<Expr> NextBinSumExpr();
-		std::shared_ptr<Expr> NextBinProExpr();
-		std::shared_ptr<Expr> NextCallExpr();
-		std::shared_ptr<Expr> NextIndexExpr();
-		std::shared_ptr<Expr> NextIndexExpr(std::shared_ptr<Expr> expr);
-		std::shared_ptr<Expr> NextMemExpr();
-		std::shared_ptr<Expr> NextMemExpr(std::shared_ptr<Expr> expr);
-		std::shared_ptr<Expr> NextPrimExpr();
+		Stmt* NextStmt(bool end);
+		EnclosedStmt* NextEnclosedStmt();
+		AliasStmt* NextAliasStmt(bool end);
+		ForStmt* NextForStmt(bool end);
+		FunStmt* NextFunStmt();
+		IfStmt* NextIfStmt();
+		IncStmt* NextIncStmt(bool end);
+		RegionStmt* NextRegionStmt(bool end);
+		RetStmt* NextRetStmt(bool end);
+		ThingStmt* NextThingStmt(bool end);
+		WhileStmt* NextWhileStmt(bool end);
+		VarStmt* NextVarStmt(Expr* expr, bool end);
 
-	private:
-		std::istream& m_Stream;
-		int m_Limit = 0;
-		int m_Index = 0;
-		char* m_Peek = nullptr;
+		Expr* NextExpr();
+		Expr* NextConExpr();
+		Expr* NextBinAndExpr();
+		Expr* NextBinOrExpr();
+		Expr* NextBinXOrExpr();
+		Expr* NextBinCmpExpr();
+		Expr* NextBinSumExpr();
+		Expr* NextBinProExpr();
+		Expr* NextCallExpr();
+		Expr* NextIndexExpr();
+		Expr* NextIndexExpr(Expr* expr);
+		Expr* NextMemExpr();
+		Expr* NextMemExpr(Expr* expr);
+		Expr* NextPrimExpr();
 
-		std::shared_ptr<Token> m_Current;
+	private:
+		std::string m_Source;
+		size_t m_Pos = 0;
+		std::deque<std::string> m_Escaped;
 		int m_Line = 1;
+
+		ASTArena m_Arena; // owns every node parsed from this source
+
+		std::vector<Token> m_Tokens;
+		size_t m_Next = 0;
+		const Token* m_Current = nullptr;
 	};
 }
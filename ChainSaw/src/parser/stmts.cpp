@@ -1,37 +1,40 @@
 #include "parser.h"
 
-std::shared_ptr<csaw::Stmt> csaw::Parser::NextStmt(bool end)
+csaw::Stmt* csaw::Parser::NextStmt(bool end)
 {
-	if (At(";")) {
+	if (At(';')) {
 		Next(); // skip ;
-		return std::shared_ptr<Stmt>();
+		return nullptr;
 	}
 
-	if (At("{"))
+	if (At('{'))
 		return NextEnclosedStmt();
 
-	if (At("alias"))
+	if (At(KEYWORD_ALIAS))
 		return NextAliasStmt(end);
 
-	if (At("for"))
+	if (At(KEYWORD_FOR))
 		return NextForStmt(end);
 
-	if (At("@") || At("$"))
+	if (At('@') || At('$'))
 		return NextFunStmt();
 
-	if (At("if"))
+	if (At(KEYWORD_IF))
 		return NextIfStmt();
 
-	if (At("inc"))
+	if (At(KEYWORD_INC))
 		return NextIncStmt(end);
 
-	if (At("ret"))
+	if (At(KEYWORD_REGION))
+		return NextRegionStmt(end);
+
+	if (At(KEYWORD_RET))
 		return NextRetStmt(end);
 
-	if (At("thing"))
+	if (At(KEYWORD_THING))
 		return NextThingStmt(end);
 
-	if (At("while"))
+	if (At(KEYWORD_WHILE))
 		return NextWhileStmt(end);
 
 	auto expr = NextExpr();
@@ -40,90 +43,90 @@ std::shared_ptr<csaw::Stmt> csaw::Parser::NextStmt(bool end)
 		return stmt;
 
 	if (!AtEof() && end)
-		ExpectAndNext(";"); // skip ;
+		ExpectAndNext(';'); // skip ;
 
 	return expr;
 }
 
-std::shared_ptr<csaw::EnclosedStmt> csaw::Parser::NextEnclosedStmt()
+csaw::EnclosedStmt* csaw::Parser::NextEnclosedStmt()
 {
-	std::vector<std::shared_ptr<Stmt>> enclosed;
+	std::vector<Stmt*> enclosed;
 
-	ExpectAndNext("{"); // skip {
-	while (!AtEof() && !At("}"))
+	ExpectAndNext('{'); // skip {
+	while (!AtEof() && !At('}'))
 		enclosed.push_back(NextStmt(true));
-	ExpectAndNext("}"); // skip }
+	ExpectAndNext('}'); // skip }
 
-	return std::make_shared<EnclosedStmt>(enclosed);
+	return m_Arena.New<EnclosedStmt>(enclosed);
 }
 
-std::shared_ptr<csaw::AliasStmt> csaw::Parser::NextAliasStmt(bool end)
+csaw::AliasStmt* csaw::Parser::NextAliasStmt(bool end)
 {
 	std::string alias;
 	std::shared_ptr<ASTType> origin;
 
-	ExpectAndNext("alias"); // skip "alias"
+	ExpectAndNext(KEYWORD_ALIAS); // skip "alias"
 	alias = m_Current->Value;
 	ExpectAndNext(TOKEN_IDENTIFIER); // skip alias
-	ExpectAndNext(":"); // skip :
+	ExpectAndNext(':'); // skip :
 	origin = NextType();
 	if (!AtEof() && end)
-		ExpectAndNext(";"); // skip ;
+		ExpectAndNext(';'); // skip ;
 
-	return std::make_shared<AliasStmt>(alias, origin);
+	return m_Arena.New<AliasStmt>(alias, origin);
 }
 
-std::shared_ptr<csaw::ForStmt> csaw::Parser::NextForStmt(bool end)
+csaw::ForStmt* csaw::Parser::NextForStmt(bool end)
 {
-	std::shared_ptr<Stmt> begin, loop, body;
-	std::shared_ptr<Expr> condition;
+	Stmt* begin = nullptr, * loop = nullptr, * body = nullptr;
+	Expr* condition = nullptr;
 
-	ExpectAndNext("for"); // skip "for"
-	ExpectAndNext("("); // skip (
-	if (!At(";"))
+	ExpectAndNext(KEYWORD_FOR); // skip "for"
+	ExpectAndNext('('); // skip (
+	if (!At(';'))
 		begin = NextStmt(true);
 	else
 		Next(); // skip ;
-	if (!At(";"))
+	if (!At(';'))
 	{
 		condition = NextExpr();
-		ExpectAndNext(";"); // skip ;
+		ExpectAndNext(';'); // skip ;
 	}
 	else
 		Next(); // skip ;
-	if (!At(")"))
+	if (!At(')'))
 		loop = NextStmt(false);
-	ExpectAndNext(")"); // skip )
+	ExpectAndNext(')'); // skip )
 
 	body = NextStmt(end);
 
-	return std::make_shared<ForStmt>(begin, condition, loop, body);
+	return m_Arena.New<ForStmt>(begin, condition, loop, body);
 }
 
-std::shared_ptr<csaw::FunStmt> csaw::Parser::NextFunStmt()
+csaw::FunStmt* csaw::Parser::NextFunStmt()
 {
-	bool constructor, vararg;
+	bool constructor, vararg, fast;
 	std::string name;
 	std::shared_ptr<ASTType> type, member;
 	std::vector<ASTParameter> parameters;
-	std::shared_ptr<EnclosedStmt> body;
+	EnclosedStmt* body = nullptr;
 
-	constructor = At("$");
+	constructor = At('$');
 	if (constructor)
 		Next(); // skip $
 	else
-		ExpectAndNext("@"); // skip @
+		ExpectAndNext('@'); // skip @
 
-	if (At("(")) // override operator
+	if (At('(')) // override operator
 	{
 		Next(); // skip (
 		name = "";
-		while (!AtEof() && !At(")")) // at least one character
+		while (!AtEof() && !At(')')) // at least one character
 		{
 			name += m_Current->Value;
 			ExpectAndNext(TOKEN_OPERATOR); // skip operator
 		}
-		ExpectAndNext(")"); // skip )
+		ExpectAndNext(')'); // skip )
 	}
 	else
 	{
@@ -135,169 +138,185 @@ std::shared_ptr<csaw::FunStmt> csaw::Parser::NextFunStmt()
 	{
 		type = ASTType::Get(name);
 	}
-	else if (At(":"))
+	else if (At(':'))
 	{
 		Next(); // skip :
 		type = NextType();
 	}
 
-	if (At("("))
+	if (At('('))
 	{
 		Next(); // skip (
-		while (!AtEof() && !At(")"))
+		while (!AtEof() && !At(')'))
 		{
 			parameters.push_back(NextParameter());
-			if (!At(")"))
-				ExpectAndNext(","); // skip ,
+			if (!At(')'))
+				ExpectAndNext(','); // skip ,
 		}
-		ExpectAndNext(")"); // skip )
+		ExpectAndNext(')'); // skip )
 	}
 
-	vararg = At("?");
+	vararg = At('?');
 	if (vararg)
 		Next(); // skip ?
 
-	if (At("-"))
+	if (At('-'))
 	{
 		Next(); // skip -
-		ExpectAndNext(">"); // skip >
+		ExpectAndNext('>'); // skip >
 		member = NextType();
 	}
 
-	if (At(";"))
+	fast = At(TOKEN_IDENTIFIER) && At("fast"); // contextual, "fast" stays a valid name elsewhere
+	if (fast)
+		Next(); // skip fast
+
+	if (At(';'))
 	{
 		Next(); // skip ;
-		return std::make_shared<FunStmt>(constructor, name, type, parameters, vararg, member, body);
+		return m_Arena.New<FunStmt>(constructor, name, type, parameters, vararg, member, fast, body);
 	}
 
 	body = NextEnclosedStmt();
 
-	return std::make_shared<FunStmt>(constructor, name, type, parameters, vararg, member, body);
+	return m_Arena.New<FunStmt>(constructor, name, type, parameters, vararg, member, fast, body);
 }
 
-std::shared_ptr<csaw::IfStmt> csaw::Parser::NextIfStmt()
+csaw::IfStmt* csaw::Parser::NextIfStmt()
 {
-	std::shared_ptr<Expr> condition;
-	std::shared_ptr<Stmt> then, else_;
+	Expr* condition = nullptr;
+	Stmt* then = nullptr, * else_ = nullptr;
 
-	ExpectAndNext("if"); // skip "if"
-	ExpectAndNext("("); // skip (
+	ExpectAndNext(KEYWORD_IF); // skip "if"
+	ExpectAndNext('('); // skip (
 	condition = NextExpr();
-	ExpectAndNext(")"); // skip )
+	ExpectAndNext(')'); // skip )
 
 	then = NextStmt(true);
 
-	if (At("else"))
+	if (At(KEYWORD_ELSE))
 	{
 		Next(); // skip "else"
 		else_ = NextStmt(true);
 	}
 
-	return std::make_shared<IfStmt>(condition, then, else_);
+	return m_Arena.New<IfStmt>(condition, then, else_);
 }
 
-std::shared_ptr<csaw::IncStmt> csaw::Parser::NextIncStmt(bool end)
+csaw::IncStmt* csaw::Parser::NextIncStmt(bool end)
 {
 	std::string path;
 
-	ExpectAndNext("inc"); // skip "inc"
+	ExpectAndNext(KEYWORD_INC); // skip "inc"
 	path = m_Current->Value;
 	ExpectAndNext(TOKEN_STRING); // skip path
 	if (!AtEof() && end)
-		ExpectAndNext(";"); // skip ;
+		ExpectAndNext(';'); // skip ;
+
+	return m_Arena.New<IncStmt>(path);
+}
 
-	return std::make_shared<IncStmt>(path);
+csaw::RegionStmt* csaw::Parser::NextRegionStmt(bool end)
+{
+	ExpectAndNext(KEYWORD_REGION); // skip "region"
+	auto body = NextStmt(end);
+	return m_Arena.New<RegionStmt>(body);
 }
 
-std::shared_ptr<csaw::RetStmt> csaw::Parser::NextRetStmt(bool end)
+csaw::RetStmt* csaw::Parser::NextRetStmt(bool end)
 {
-	std::shared_ptr<Expr> value;
+	Expr* value = nullptr;
 
-	ExpectAndNext("ret"); // skip "ret"
-	if (!At(";"))
+	ExpectAndNext(KEYWORD_RET); // skip "ret"
+	if (!At(';'))
 		value = NextExpr();
 	if (!AtEof() && end)
-		ExpectAndNext(";"); // skip ;
+		ExpectAndNext(';'); // skip ;
 
-	return std::make_shared<RetStmt>(value);
+	return m_Arena.New<RetStmt>(value);
 }
 
-std::shared_ptr<csaw::ThingStmt> csaw::Parser::NextThingStmt(bool end)
+csaw::ThingStmt* csaw::Parser::NextThingStmt(bool end)
 {
 	std::string name, group = "";
 	std::vector<ASTParameter> fields;
+	bool value;
 
-	ExpectAndNext("thing"); // skip "thing"
-	ExpectAndNext(":"); // skip :
+	ExpectAndNext(KEYWORD_THING); // skip "thing"
+	ExpectAndNext(':'); // skip :
 	name = m_Current->Value;
 	ExpectAndNext(TOKEN_IDENTIFIER); // skip name
 
-	if (At(":"))
+	if (At(':'))
 	{
 		Next(); // skip :
 		group = m_Current->Value;
 		ExpectAndNext(TOKEN_IDENTIFIER);
 	}
 
-	if (At(";"))
+	value = At(TOKEN_IDENTIFIER) && At("value"); // contextual, "value" stays a valid name elsewhere
+	if (value)
+		Next(); // skip value
+
+	if (At(';'))
 	{
 		Next(); // skip ;
-		return std::make_shared<ThingStmt>(name, group, fields);
+		return m_Arena.New<ThingStmt>(name, group, fields, value);
 	}
 
-	ExpectAndNext("{"); // skip {
-	while (!AtEof() && !At("}"))
+	ExpectAndNext('{'); // skip {
+	while (!AtEof() && !At('}'))
 	{
 		fields.push_back(NextParameter());
-		if (!At("}"))
-			ExpectAndNext(","); // skip ,
+		if (!At('}'))
+			ExpectAndNext(','); // skip ,
 	}
-	ExpectAndNext("}"); // skip }
+	ExpectAndNext('}'); // skip }
 
-	return std::make_shared<ThingStmt>(name, group, fields);
+	return m_Arena.New<ThingStmt>(name, group, fields, value);
 }
 
-std::shared_ptr<csaw::WhileStmt> csaw::Parser::NextWhileStmt(bool end)
+csaw::WhileStmt* csaw::Parser::NextWhileStmt(bool end)
 {
-	std::shared_ptr<Expr> condition;
-	std::shared_ptr<Stmt> body;
+	Expr* condition = nullptr;
+	Stmt* body = nullptr;
 
-	ExpectAndNext("while"); // skip "while"
-	ExpectAndNext("("); // skip (
+	ExpectAndNext(KEYWORD_WHILE); // skip "while"
+	ExpectAndNext('('); // skip (
 	condition = NextExpr();
-	ExpectAndNext(")"); // skip )
+	ExpectAndNext(')'); // skip )
 
 	body = NextStmt(end);
 
-	return std::make_shared<WhileStmt>(condition, body);
+	return m_Arena.New<WhileStmt>(condition, body);
 }
 
-std::shared_ptr<csaw::VarStmt> csaw::Parser::NextVarStmt(const std::shared_ptr<Expr>& expr, bool end)
+csaw::VarStmt* csaw::Parser::NextVarStmt(Expr* expr, bool end)
 {
-	if ((std::dynamic_pointer_cast<IdExpr>(expr) || std::dynamic_pointer_cast<IndexExpr>(expr)) && At(TOKEN_IDENTIFIER))
+	if ((As<IdExpr>(expr) || As<IndexExpr>(expr)) && At(TOKEN_IDENTIFIER))
 	{
 		std::shared_ptr<ASTType> type;
 		std::string name;
-		std::shared_ptr<Expr> value;
+		Expr* value = nullptr;
 
 		type = NextType(expr);
 		name = m_Current->Value;
 		ExpectAndNext(TOKEN_IDENTIFIER); // skip name
 
-		if (At(";"))
+		if (At(';'))
 		{
 			Next();
-			return std::make_shared<VarStmt>(type, name, value);
+			return m_Arena.New<VarStmt>(type, name, value);
 		}
 
-		ExpectAndNext("="); // skip =
+		ExpectAndNext('='); // skip =
 
 		value = NextExpr();
 		if (!AtEof() && end)
-			ExpectAndNext(";"); // skip ;
+			ExpectAndNext(';'); // skip ;
 
-		return std::make_shared<VarStmt>(type, name, value);
+		return m_Arena.New<VarStmt>(type, name, value);
 	}
 
-	return std::shared_ptr<VarStmt>();
+	return nullptr;
 }
@@ -0,0 +1,37 @@
+# python genir.py [statements] > genir.csaw
+# csaw genir.csaw -time -O0
+# writes a synthetic file of about 100k statements (or the given count) to time GenIR with -time.
+# every function mixes declarations, arithmetic, branches, loops and calls, like real code does
+
+import sys
+
+statements = int(sys.argv[1]) if len(sys.argv) > 1 else 100000
+per_function = 10  # statements in each function below, counting nested ones
+
+print("@csaw_printf (format: str) ?;")
+print()
+print("@f0: num (x: num) {")
+print("\tret x;")
+print("}")
+
+for i in range(1, statements // per_function + 1):
+    print()
+    print(f"@f{i}: num (x: num) {{")
+    print(f"\tnum a = x * 2 + {i};")
+    print("\tnum b = a - x / 3;")
+    print("\tif (a > b)")
+    print("\t\ta = b + 1;")
+    print("\telse")
+    print("\t\tb = a - 1;")
+    print("\tfor (num j = 0; j < 4; j++)")
+    print("\t\ta += j * b;")
+    print("\twhile (a > 100)")
+    print("\t\ta = a / 2;")
+    print(f"\tret a + b + f{i - 1}(b);")
+    print("}")
+
+print()
+print("@main: num {")
+print("\tcsaw_printf(\"generated\\n\");")
+print("\tret 0;")
+print("}")
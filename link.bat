@@ -1 +1 @@
-lld-link output.o .\x64\Debug\CSawStd.lib
\ No newline at end of file
+if exist output.0.o (lld-link output.*.o .\x64\Debug\CSawStd.lib) else (lld-link output.o .\x64\Debug\CSawStd.lib)
\ No newline at end of file